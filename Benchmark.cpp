@@ -0,0 +1,666 @@
+﻿#define DOCEDITOR_ALLOCATION_HOOK // The allocation counter lives in this file (see DocEditor.h)
+#include "DocEditor.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+
+/**
+ * Benchmark Suite
+ * Times every core editor operation on synthetic documents and reports
+ * latency, throughput and allocations per call, as a table and optionally
+ * as JSON so results can be compared across builds.
+ */
+struct BenchmarkConfig {
+    int pages = 10000;        // Size of the plain document
+    int searchMegabytes = 64; // Size of the document for the parallel search runs
+    int cipherKilobytes = 16384; // Size of the encrypted document
+    int headingsPerPage = 2;  // Heading density of the plain document
+    int iterations = 10;      // Repetitions of the slower operations
+    string jsonPath = "";     // "-" writes JSON to stdout (the table goes to stderr)
+    string label = "";        // Free text copied into the JSON, e.g. a commit id
+    string scratchFile = "doceditor_bench.tmp";
+    string documentPath = ""; // --write-document: save the plain document and exit
+    string sessionPath = "";  // --write-session: save a key script for --replay and exit
+    int sessionKeys = 100000;
+};
+
+struct BenchmarkResult {
+    string name;
+    string params;
+    int iterations;
+    double meanMs, p50Ms, minMs, maxMs;
+    long long bytesPerIteration;
+    long long allocationsPerIteration;
+};
+
+vector<BenchmarkResult> benchmarkResults;
+FILE* benchmarkReport = stdout;
+volatile long long benchmarkSink = 0; // Keeps results of pure calls from being optimized away
+
+double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Runs setup (untimed) then body, iterations times, and records the body's timings
+void runBenchmark(const string& name, const string& params, int iterations, long long bytes,
+    const function<void()>& setup, const function<void()>& body) {
+    if (iterations < 1) iterations = 1;
+    vector<double> times;
+    long long allocations = 0;
+    for (int i = 0; i < iterations; ++i) {
+        if (setup) setup();
+        long long allocsBefore = threadAllocationCount;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        body();
+        times.push_back(elapsedMs(start));
+        allocations += threadAllocationCount - allocsBefore;
+    }
+
+    BenchmarkResult result;
+    result.name = name;
+    result.params = params;
+    result.iterations = iterations;
+    double total = 0;
+    for (size_t i = 0; i < times.size(); ++i) total += times[i];
+    result.meanMs = total / iterations;
+    sort(times.begin(), times.end());
+    result.p50Ms = times[(times.size() - 1) / 2];
+    result.minMs = times.front();
+    result.maxMs = times.back();
+    result.bytesPerIteration = bytes;
+    result.allocationsPerIteration = allocations / iterations;
+    benchmarkResults.push_back(result);
+
+    string title = name + (params.empty() ? "" : " [" + params + "]");
+    fprintf(benchmarkReport, "  %-56s %10.3f ms  p50 %10.3f ms", title.c_str(), result.meanMs, result.p50Ms);
+    if (bytes > 0 && result.meanMs > 0) fprintf(benchmarkReport, "  %8.1f MB/s", bytes / (1024.0 * 1024.0) / (result.meanMs / 1000.0));
+    else fprintf(benchmarkReport, "  %13s", "");
+    if (allocationCountingEnabled) fprintf(benchmarkReport, "  %8lld allocs\n", result.allocationsPerIteration);
+    else fprintf(benchmarkReport, "  %8s allocs\n", "n/a");
+}
+
+/**
+ * Console Sink
+ * Rendering benchmarks draw into a buffer that discards everything, so they
+ * measure the layout work rather than the terminal.
+ */
+struct NullBuffer : streambuf {
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char*, streamsize count) override { return count; }
+};
+
+NullBuffer nullBuffer;
+streambuf* savedCoutBuffer = nullptr;
+
+void muteConsole() { savedCoutBuffer = cout.rdbuf(&nullBuffer); }
+void unmuteConsole() { cout.rdbuf(savedCoutBuffer); }
+
+/**
+ * Synthetic Document Generators
+ * All generators are deterministic so runs on different builds see the
+ * same input.
+ */
+unsigned int benchmarkSeed = 12345;
+
+unsigned int nextRandom() {
+    benchmarkSeed = benchmarkSeed * 1103515245 + 12345;
+    return (benchmarkSeed >> 16) & 0x7FFF;
+}
+
+const char* benchmarkWords[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do",
+    "eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore", "magna", "aliqua", "enim",
+    "minim", "veniam", "quis", "nostrud", "exercitation", "ullamco", "laboris", "nisi", "aliquip", "commodo"
+};
+const int benchmark_word_count = sizeof(benchmarkWords) / sizeof(benchmarkWords[0]);
+
+// A paragraph of roughly the given length, made of random dictionary words
+string generateParagraph(int characters) {
+    string paragraph;
+    while ((int)paragraph.length() < characters) {
+        if (!paragraph.empty()) paragraph += ' ';
+        paragraph += benchmarkWords[nextRandom() % benchmark_word_count];
+    }
+    return paragraph;
+}
+
+// A line of text that fits one column
+string generateLine() {
+    string line = generateParagraph(col_width - 8);
+    return line.length() > (size_t)col_width ? line.substr(0, col_width) : line;
+}
+
+// Full pages of column-width lines; headingsPerPage lines per page are headings (levels 1-3)
+string generateDocument(int pageCount, int headingsPerPage) {
+    string doc;
+    int headingNumber = 0;
+    for (int p = 0; p < pageCount; ++p) {
+        int headingStride = (headingsPerPage > 0) ? MAX_LINES_PER_PAGE_STORAGE / headingsPerPage : 0;
+        for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) {
+            if (headingStride > 0 && l % headingStride == 0) {
+                headingNumber++;
+                doc += string(1 + headingNumber % 3, '#') + " Section " + to_string(headingNumber);
+            }
+            else doc += generateLine();
+            if (l < MAX_LINES_PER_PAGE_STORAGE - 1) doc += DELIMITER;
+        }
+        if (p < pageCount - 1) doc += PAGE_DELIMITER;
+    }
+    return doc;
+}
+
+// A document of about the given size in bytes
+string generateDocumentOfSize(long long bytes, int headingsPerPage) {
+    long long pageBytes = generateDocument(1, headingsPerPage).length() + 1;
+    return generateDocument((int)max(1LL, bytes / pageBytes), headingsPerPage);
+}
+
+/**
+ * Editing Session Generator
+ * A key script for the editor's --replay mode mixing the things people do:
+ * paging and jumping, typing paragraphs and headings, searching, undo/redo,
+ * alignment changes and the TOC and stats screens. 'q' is not bound on
+ * any screen, so it follows every action that may stop at a prompt ("Undo
+ * Stack Empty", "Page full", a TOC entry that does not exist) and is
+ * otherwise ignored.
+ */
+string generateSession(int keyCount, int pageCount) {
+    string keys;
+    while ((int)keys.length() < keyCount) {
+        int action = nextRandom() % 100;
+        if (action < 30) keys += string(1 + nextRandom() % 5, (nextRandom() % 3 == 0) ? 'P' : 'N');
+        else if (action < 45) keys += "G" + to_string(1 + nextRandom() % pageCount) + "\r";
+        else if (action < 60) keys += "A" + generateParagraph(40 + nextRandom() % 160) + "\rq";
+        else if (action < 65) keys += "A" + string(1 + nextRandom() % 3, '#') + " " + generateParagraph(12) + "\rq";
+        else if (action < 75) keys += string("S") + benchmarkWords[nextRandom() % benchmark_word_count] + "\rq";
+        else if (action < 85) keys += (nextRandom() % 2 == 0) ? "Uq" : "Rq";
+        else if (action < 92) keys += "LTCJ"[nextRandom() % 4];
+        else if (action < 96) keys += "INNq";
+        else if (action < 99) keys += "I" + to_string(1 + nextRandom() % 20) + "\rq";
+        else keys += "Mq";
+    }
+    return keys;
+}
+
+/**
+ * Text Layout: paragraph wrapping with each alignment, and column balancing
+ */
+void benchmarkTextLayout(const BenchmarkConfig& config) {
+    fprintf(benchmarkReport, "Text layout\n");
+    deserializeDocument("");
+    const char* alignmentNames[] = { "left", "right", "center", "justify" };
+    string paragraph = generateParagraph(MAX_LINES_PER_PAGE_STORAGE * col_width * 3 / 4);
+    int repetitions = config.iterations * 20;
+
+    for (int a = 0; a < 4; ++a) {
+        runBenchmark("wrap.paragraph", string("align=") + alignmentNames[a] + " chars=" + to_string(paragraph.length()),
+            repetitions, paragraph.length(),
+            [&] { currentAlignment = a; activeDoc->currentPagePtr->rewriteSlab(); },
+            [&] { processParagraph(paragraph); });
+    }
+    currentAlignment = 0;
+
+    // Many short paragraphs on one page exercise the balancing search for a split point
+    activeDoc->currentPagePtr->rewriteSlab();
+    for (int i = 0; i < 12; ++i) processParagraph(generateParagraph(60 + (int)(nextRandom() % 60)));
+    int pageNumber = getPageDisplayNumber(activeDoc->currentPagePtr);
+    muteConsole();
+    runBenchmark("render.balance_columns", "paragraphs=12", repetitions, activeDoc->currentPagePtr->slab->text.length(),
+        nullptr, [&] { displayPageContent(pageNumber); });
+
+    activeDoc->currentSearchTerm = "dolor";
+    activeDoc->isSearchMode = true;
+    runBenchmark("render.highlight", "term=dolor", repetitions, activeDoc->currentPagePtr->slab->text.length(),
+        nullptr, [&] { displayPageContent(pageNumber); });
+    activeDoc->isSearchMode = false;
+    activeDoc->currentSearchTerm = "";
+    unmuteConsole();
+}
+
+/**
+ * Document Operations: load, serialize, TOC and search on the plain document
+ */
+void benchmarkDocument(const BenchmarkConfig& config) {
+    string doc = generateDocument(config.pages, config.headingsPerPage);
+    string params = "pages=" + to_string(config.pages) + " headings/page=" + to_string(config.headingsPerPage);
+    fprintf(benchmarkReport, "Document (%d pages, %.1f MB)\n", config.pages, doc.length() / (1024.0 * 1024.0));
+
+    runBenchmark("document.deserialize", params, config.iterations, doc.length(), nullptr, [&] { deserializeDocument(doc); });
+    string out;
+    runBenchmark("document.serialize", params, config.iterations, doc.length(), nullptr, [&] { out = serializeDocument(); });
+    if (out != document_format_magic + doc) fprintf(benchmarkReport, "  serialize: OUTPUT MISMATCH\n");
+
+    // TOC: draw every screen of entries, and look up headings by number
+    int tocCount = getHeadingTotal();
+    int screens = (tocCount + toc_entries_per_screen - 1) / toc_entries_per_screen;
+    muteConsole();
+    runBenchmark("toc.draw_all_screens", "entries=" + to_string(tocCount), 3, 0, nullptr, [&] {
+        for (int s = 0; s < screens; ++s) drawTOCEntries(s * toc_entries_per_screen, tocCount, 3);
+    });
+    unmuteConsole();
+    runBenchmark("toc.locate_heading", "lookups=100000", config.iterations, 0, nullptr, [&] {
+        int slot = 0;
+        for (int i = 0; i < 100000 && tocCount > 0; ++i) {
+            benchmarkSink = benchmarkSink + locateHeading((int)(((long long)i * 7919) % tocCount), slot)->pageIndex + slot;
+        }
+    });
+
+    // Statistics: the status bar totals, word lookups and re-indexing an edited page
+    long long wordTotal = 0;
+    for (int p = 0; p < getPageCount(); ++p) wordTotal += countSlabStats(getPageByNumber(p + 1)->slab).words;
+    if (wordTotal != getWordTotal()) fprintf(benchmarkReport, "  stats: WORD TOTAL MISMATCH\n");
+    runBenchmark("stats.totals", "calls=100000", config.iterations, 0, nullptr, [&] {
+        for (int i = 0; i < 100000; ++i) benchmarkSink = benchmarkSink + getWordTotal() + getCharacterTotal();
+    });
+    runBenchmark("stats.word_lookup", "lookups=100000", config.iterations, 0, nullptr, [&] {
+        for (int i = 0; i < 100000 && wordTotal > 0; ++i) {
+            benchmarkSink = benchmarkSink + findPageOfWord(1 + ((long long)i * 7919) % wordTotal)->pageIndex;
+        }
+    });
+    DocumentPage* statsPage = getPageByNumber(config.pages / 2 + 1);
+    runBenchmark("stats.index_page", "", config.iterations * 100, statsPage->slab->text.length(), nullptr,
+        [&] { indexPage(statsPage); });
+
+    // Search: the current page (what the S key highlights) and the whole document
+    activeDoc->currentPagePtr = getPageByNumber(config.pages / 2 + 1);
+    runBenchmark("search.page", "term=dolor", config.iterations * 100, activeDoc->currentPagePtr->slab->text.length(),
+        nullptr, [&] { benchmarkSink = benchmarkSink + searchAndHighlight("dolor"); });
+
+    vector<PageSlab*> snapshot = snapshotDocument();
+    string upperTerm = toUpper("dolor");
+    vector<SearchMatch> found;
+    runBenchmark("search.document.sequential", params, config.iterations, doc.length(), nullptr, [&] {
+        found.clear();
+        for (int p = 0; p < (int)snapshot.size(); ++p) findMatchesInSlab(snapshot[p], upperTerm, p, found);
+    });
+    for (int i = 0; i < (int)snapshot.size(); ++i) releaseSlab(snapshot[i]);
+}
+
+bool sameMatches(const vector<SearchMatch>& a, const vector<SearchMatch>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].page != b[i].page || a[i].line != b[i].line || a[i].column != b[i].column) return false;
+    }
+    return true;
+}
+
+/**
+ * Parallel Search Scaling
+ * Runs the document search on pools of 1..32 workers. The search is posted as
+ * a single job so exactly that many threads take part, and every result is
+ * checked against a plain sequential scan.
+ */
+void benchmarkParallelSearch(const BenchmarkConfig& config) {
+    deserializeDocument(generateDocumentOfSize((long long)config.searchMegabytes * 1024 * 1024, config.headingsPerPage));
+    vector<PageSlab*> snapshot = snapshotDocument();
+    long long bytes = serializeDocument().length();
+    string upperTerm = toUpper("dolor");
+    fprintf(benchmarkReport, "Parallel search (%d pages, %d MB, %u hardware threads)\n",
+        (int)snapshot.size(), config.searchMegabytes, thread::hardware_concurrency());
+
+    vector<SearchMatch> expected;
+    for (int p = 0; p < (int)snapshot.size(); ++p) findMatchesInSlab(snapshot[p], upperTerm, p, expected);
+
+    int threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+    for (int t = 0; t < 6; ++t) {
+        startWorkerPool(threadCounts[t]);
+        vector<SearchMatch> found;
+        runBenchmark("search.document.parallel", "threads=" + to_string(threadCounts[t]), max(1, config.iterations / 2), bytes,
+            nullptr, [&] {
+                atomic<bool> done(false);
+                postWorkerJob([&] {
+                    found = findMatchesInSnapshot(snapshot, upperTerm);
+                    done.store(true);
+                });
+                while (!done.load()) this_thread::sleep_for(chrono::microseconds(200));
+            });
+        if (!sameMatches(found, expected)) fprintf(benchmarkReport, "  threads=%d: RESULT MISMATCH\n", threadCounts[t]);
+    }
+    stopWorkerPool();
+    for (int i = 0; i < (int)snapshot.size(); ++i) releaseSlab(snapshot[i]);
+}
+
+/**
+ * Cipher and Files: encrypt/decrypt, plain and encrypted save/load round trips
+ */
+void benchmarkCipherAndFiles(const BenchmarkConfig& config) {
+    string key = "benchmark-key";
+    string cipherDoc = generateDocumentOfSize((long long)config.cipherKilobytes * 1024, config.headingsPerPage);
+    string cipherParams = "bytes=" + to_string(cipherDoc.length());
+    fprintf(benchmarkReport, "Cipher and files\n");
+
+    // Short keys used to cost the most: the key index was reduced by repeated subtraction per byte
+    string encrypted, decrypted;
+    const string keys[] = { "k", key, string(64, 'K') };
+    for (const string& cipherKey : keys) {
+        string keyParams = cipherParams + ",key=" + to_string(cipherKey.length());
+        runBenchmark("cipher.encrypt", keyParams, config.iterations, cipherDoc.length(), nullptr,
+            [&] { encrypted = encrypt(cipherDoc, cipherKey); });
+        runBenchmark("cipher.decrypt", keyParams, config.iterations, cipherDoc.length(), nullptr,
+            [&] { decrypted = decrypt(encrypted, cipherKey); });
+        if (decrypted != cipherDoc) fprintf(benchmarkReport, "  key=%d: ROUND TRIP MISMATCH\n", (int)cipherKey.length());
+    }
+    encrypted = encrypt(cipherDoc, key);
+    runBenchmark("cipher.detect", cipherParams, config.iterations, encrypted.length(), nullptr,
+        [&] { benchmarkSink = benchmarkSink + isLikelyEncrypted(encrypted); });
+    runBenchmark("cipher.detect.plain", cipherParams, config.iterations, cipherDoc.length(), nullptr,
+        [&] { benchmarkSink = benchmarkSink + isLikelyEncrypted(cipherDoc); });
+    runBenchmark("checksum.xor8", cipherParams, config.iterations, encrypted.length(), nullptr,
+        [&] { benchmarkSink = benchmarkSink + calculateChecksum(encrypted); });
+    runBenchmark("checksum.crc32c", cipherParams, config.iterations, encrypted.length(), nullptr,
+        [&] { benchmarkSink = benchmarkSink + crc32c(encrypted); });
+
+    // Plain files: the whole document as saved by [V] and opened by [O]
+    string doc = generateDocument(config.pages, config.headingsPerPage);
+    string params = "pages=" + to_string(config.pages);
+    deserializeDocument(doc);
+    runBenchmark("file.save.plain", params, config.iterations, doc.length(), nullptr,
+        [&] { writeFile(config.scratchFile, serializeDocument()); });
+    runBenchmark("file.load.plain", params, config.iterations, doc.length(), nullptr,
+        [&] { string data = readFile(config.scratchFile); deserializeDocument(data); });
+
+    // Encrypted files: fingerprinted payload, cipher and file framing as the editor writes them
+    deserializeDocument(cipherDoc);
+    vector<PageSlab*> snapshot = snapshotDocument();
+    runBenchmark("file.save.encrypted", cipherParams, config.iterations, cipherDoc.length(), nullptr, [&] {
+        string payload = serializeSnapshot(snapshot, nullptr, getKeyFingerprint(key));
+        writeFile(config.scratchFile, buildEncryptedFile(encrypt(payload, key)));
+    });
+    for (int i = 0; i < (int)snapshot.size(); ++i) releaseSlab(snapshot[i]);
+    runBenchmark("file.load.encrypted", cipherParams, config.iterations, cipherDoc.length(), nullptr, [&] {
+        string cipher;
+        if (!extractFileCipher(readFile(config.scratchFile), cipher)) return;
+        string payload = decrypt(cipher, key);
+        if (matchesKeyFingerprint(payload, key)) deserializeDocument(string_view(payload).substr(key_fingerprint_length));
+    });
+    if (serializeDocument() != document_format_magic + cipherDoc) fprintf(benchmarkReport, "  encrypted file: ROUND TRIP MISMATCH\n");
+    remove(config.scratchFile.c_str());
+}
+
+/**
+ * Undo and Redo: edit-snapshot cycles and full-depth undo/redo walks on one page
+ */
+void benchmarkHistory(const BenchmarkConfig& config) {
+    fprintf(benchmarkReport, "Undo and redo\n");
+    deserializeDocument(generateDocument(4, config.headingsPerPage));
+    clearAllUndoRedoStacks();
+    activeDoc->currentPagePtr = activeDoc->headPage;
+    int pageIndex = activeDoc->currentPagePtr->pageIndex;
+    string line = generateLine();
+    int repetitions = config.iterations * 1000;
+
+    runBenchmark("history.push_and_edit", "ops=" + to_string(repetitions), 1, 0, nullptr, [&] {
+        for (int i = 0; i < repetitions; ++i) {
+            pushUndo(pageIndex);
+            activeDoc->currentPagePtr->setLine(i % MAX_LINES_PER_PAGE_STORAGE, line);
+        }
+    });
+
+    runBenchmark("history.undo_redo_walk", "depth=" + to_string(history_depth), config.iterations * 100, 0,
+        [&] {
+            clearAllUndoRedoStacks();
+            for (int i = 0; i < history_depth; ++i) {
+                pushUndo(pageIndex);
+                activeDoc->currentPagePtr->setLine(i, line);
+            }
+        },
+        [&] {
+            PageSlab* state;
+            while ((state = popUndo(pageIndex)) != nullptr) { pushRedo(pageIndex); restorePageSnapshot(activeDoc->currentPagePtr, state); }
+            while ((state = popRedo(pageIndex)) != nullptr) { pushUndoForRedo(pageIndex); restorePageSnapshot(activeDoc->currentPagePtr, state); }
+        });
+    clearAllUndoRedoStacks();
+}
+
+/**
+ * Document Session: switching between open documents, and evicting one to disk and back
+ */
+void benchmarkSession(const BenchmarkConfig& config) {
+    fprintf(benchmarkReport, "Document session\n");
+    string doc = generateDocument(config.pages, config.headingsPerPage);
+    string params = "pages=" + to_string(config.pages);
+
+    // Switching checks the memory limit (the default 256 MB is not reached here)
+    Document* first = activeDoc;
+    deserializeDocument(doc);
+    Document* second = createDocument();
+    deserializeDocument(doc);
+    runBenchmark("session.switch", params, config.iterations * 100, 0, nullptr,
+        [&] { switchToDocument(activeDoc == first ? second : first); });
+
+    long long savedLimit = sessionMemoryLimit;
+    sessionMemoryLimit = 0; // Evictions only where measured
+    switchToDocument(first);
+    runBenchmark("session.evict_restore", params, config.iterations, doc.length(), nullptr,
+        [&] { evictDocument(second); restoreDocument(second); });
+    {
+        ActiveDocumentScope scope(second);
+        if (serializeDocument() != document_format_magic + doc) fprintf(benchmarkReport, "  evict/restore: ROUND TRIP MISMATCH\n");
+    }
+    closeDocument(second);
+    sessionMemoryLimit = savedLimit;
+}
+
+/**
+ * Export: each format from a snapshot (as the X key runs it) and streamed
+ * from a saved file (as --export runs it)
+ */
+void benchmarkExport(const BenchmarkConfig& config) {
+    fprintf(benchmarkReport, "Export\n");
+    string doc = generateDocument(config.pages, config.headingsPerPage);
+    string params = "pages=" + to_string(config.pages);
+    deserializeDocument(doc);
+    vector<PageSlab*> snapshot = snapshotDocument();
+
+    const char* extensions[] = { ".txt", ".md", ".html" };
+    for (int f = 0; f < 3; ++f) {
+        string target = config.scratchFile + extensions[f];
+        for (int h = 0; h < 2; ++h) {
+            string highlight = (h == 0) ? "" : "dolor";
+            string formatParams = params + string(",format=") + (extensions[f] + 1) + (h == 0 ? "" : ",highlight=dolor");
+            runBenchmark("export.snapshot", formatParams, config.iterations, doc.length(), nullptr, [&] {
+                BufferedWriter out(target);
+                ExportSource source = makeSnapshotSource(snapshot);
+                exportPages(source, out, getExportFormat(target), "benchmark", highlight);
+                out.close();
+            });
+        }
+        if (readFile(target).empty()) fprintf(benchmarkReport, "  %s: EXPORT FAILED\n", extensions[f] + 1);
+        remove(target.c_str());
+    }
+    for (int i = 0; i < (int)snapshot.size(); ++i) releaseSlab(snapshot[i]);
+
+    writeFile(config.scratchFile, serializeDocument());
+    string target = config.scratchFile + ".html";
+    string error;
+    runBenchmark("export.file", params + ",format=html", config.iterations, doc.length(), nullptr, [&] {
+        if (!exportFile(config.scratchFile, target, "dolor", error)) fprintf(benchmarkReport, "  export.file: %s\n", error.c_str());
+    });
+    remove(target.c_str());
+    remove(config.scratchFile.c_str());
+}
+
+/**
+ * Document Compare: an edited version against the original (the K key),
+ * an identical copy, and a version where every page was rewritten
+ */
+void benchmarkCompare(const BenchmarkConfig& config) {
+    fprintf(benchmarkReport, "Document compare\n");
+    string doc = generateDocument(config.pages, config.headingsPerPage);
+    string params = "pages=" + to_string(config.pages);
+    vector<string> pages;
+    size_t start = 0, end;
+    while ((end = doc.find(PAGE_DELIMITER, start)) != string::npos) { pages.push_back(doc.substr(start, end - start)); start = end + 1; }
+    pages.push_back(doc.substr(start));
+
+    // A handful of edits spread over the document: 5 changed, 2 inserted and 2 deleted pages
+    vector<string> edited = pages;
+    int count = (int)pages.size();
+    for (int e = 0; e < 5; ++e) {
+        string& page = edited[(count * (2 * e + 1)) / 12];
+        page.insert(page.find(DELIMITER) + 1, "edited ");
+    }
+    edited.erase(edited.begin() + (count * 11) / 12);
+    edited.erase(edited.begin() + (count * 4) / 12);
+    edited.insert(edited.begin() + (count * 8) / 12, generateDocument(1, config.headingsPerPage));
+    edited.insert(edited.begin() + (count * 2) / 12, generateDocument(1, config.headingsPerPage));
+    string editedDoc;
+    for (int p = 0; p < (int)edited.size(); ++p) editedDoc += (p > 0 ? string(1, PAGE_DELIMITER) : "") + edited[p];
+
+    Document* original = activeDoc;
+    deserializeDocument(doc);
+    Document* other = createDocument();
+    DocumentComparison comparison;
+    const char* names[] = { "compare.edited", "compare.identical", "compare.rewritten" };
+    for (int v = 0; v < 3; ++v) {
+        if (v == 0) deserializeDocument(editedDoc);
+        else if (v == 1) deserializeDocument(doc);
+        else deserializeDocument(generateDocument(config.pages, config.headingsPerPage));
+        runBenchmark(names[v], params, config.iterations, doc.length(), nullptr, [&] {
+            releaseComparison(comparison);
+            comparison = DocumentComparison();
+            compareDocuments(original, other, comparison);
+        });
+        bool expected = (v == 0) ? comparison.changedPages == 5 && comparison.insertedPages == 2 && comparison.deletedPages == 2 :
+            (v == 1) ? comparison.changes.empty() : comparison.unchangedPages == 0;
+        if (!expected) {
+            fprintf(benchmarkReport, "  %s: UNEXPECTED RESULT (%d changed, %d inserted, %d deleted)\n", names[v],
+                comparison.changedPages, comparison.insertedPages, comparison.deletedPages);
+        }
+    }
+    releaseComparison(comparison);
+    closeDocument(other);
+}
+
+/**
+ * JSON Report
+ */
+string jsonEscape(const string& text) {
+    string out;
+    for (size_t i = 0; i < text.length(); ++i) {
+        char c = text[i];
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if ((unsigned char)c < 0x20) { char buffer[8]; snprintf(buffer, sizeof(buffer), "\\u%04x", c); out += buffer; }
+        else out += c;
+    }
+    return out;
+}
+
+string getCompilerName() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+void writeJsonReport(FILE* out, const BenchmarkConfig& config) {
+#ifdef NDEBUG
+    const char* buildType = "release";
+#else
+    const char* buildType = "debug";
+#endif
+    fprintf(out, "{\n  \"schema\": 1,\n  \"label\": \"%s\",\n  \"compiler\": \"%s\",\n  \"build\": \"%s\",\n",
+        jsonEscape(config.label).c_str(), jsonEscape(getCompilerName()).c_str(), buildType);
+    fprintf(out, "  \"hardware_threads\": %u,\n", thread::hardware_concurrency());
+    fprintf(out, "  \"config\": {\"pages\": %d, \"search_mb\": %d, \"cipher_kb\": %d, \"headings_per_page\": %d, \"iterations\": %d},\n",
+        config.pages, config.searchMegabytes, config.cipherKilobytes, config.headingsPerPage, config.iterations);
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < benchmarkResults.size(); ++i) {
+        const BenchmarkResult& r = benchmarkResults[i];
+        double mbPerSecond = (r.bytesPerIteration > 0 && r.meanMs > 0) ? r.bytesPerIteration / (1024.0 * 1024.0) / (r.meanMs / 1000.0) : 0;
+        fprintf(out, "    {\"name\": \"%s\", \"params\": \"%s\", \"iterations\": %d, \"mean_ms\": %.6f, \"p50_ms\": %.6f, "
+            "\"min_ms\": %.6f, \"max_ms\": %.6f, \"bytes\": %lld, \"mb_per_s\": %.3f, \"allocs\": %s}%s\n",
+            jsonEscape(r.name).c_str(), jsonEscape(r.params).c_str(), r.iterations, r.meanMs, r.p50Ms, r.minMs, r.maxMs,
+            r.bytesPerIteration, mbPerSecond, allocationCountingEnabled ? to_string(r.allocationsPerIteration).c_str() : "null",
+            (i + 1 < benchmarkResults.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+void printUsage() {
+    fprintf(stderr,
+        "Usage: Benchmark [options]\n"
+        "  --pages N         pages in the plain document (default 10000)\n"
+        "  --search-mb N     document size for parallel search scaling (default 64)\n"
+        "  --cipher-kb N     document size for cipher and encrypted file runs (default 16384)\n"
+        "  --headings N      headings per page, 0-40 (default 2)\n"
+        "  --iterations N    repetitions of each measurement (default 10)\n"
+        "  --quick           small sizes for a smoke run\n"
+        "  --json FILE       also write results as JSON (\"-\" for stdout)\n"
+        "  --label TEXT      label stored in the JSON (e.g. a commit id)\n"
+        "  --write-document FILE  write the plain document (--pages, --headings) and exit\n"
+        "  --write-session FILE   write an editing key script for the editor's --replay and exit\n"
+        "  --session-keys N       keys in the written session (default 100000)\n");
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkConfig config;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--pages" && hasValue) config.pages = atoi(argv[++i]);
+        else if (arg == "--search-mb" && hasValue) config.searchMegabytes = atoi(argv[++i]);
+        else if (arg == "--cipher-kb" && hasValue) config.cipherKilobytes = atoi(argv[++i]);
+        else if (arg == "--headings" && hasValue) config.headingsPerPage = atoi(argv[++i]);
+        else if (arg == "--iterations" && hasValue) config.iterations = atoi(argv[++i]);
+        else if (arg == "--json" && hasValue) config.jsonPath = argv[++i];
+        else if (arg == "--label" && hasValue) config.label = argv[++i];
+        else if (arg == "--write-document" && hasValue) config.documentPath = argv[++i];
+        else if (arg == "--write-session" && hasValue) config.sessionPath = argv[++i];
+        else if (arg == "--session-keys" && hasValue) config.sessionKeys = atoi(argv[++i]);
+        else if (arg == "--quick") { config.pages = 500; config.searchMegabytes = 4; config.cipherKilobytes = 16; config.iterations = 3; }
+        else { printUsage(); return 1; }
+    }
+    if (config.pages < 1 || config.searchMegabytes < 1 || config.cipherKilobytes < 1 || config.iterations < 1 ||
+        config.headingsPerPage < 0 || config.headingsPerPage > MAX_LINES_PER_PAGE_STORAGE) {
+        printUsage();
+        return 1;
+    }
+    if (config.jsonPath == "-") benchmarkReport = stderr;
+
+    // Inputs for end-to-end replays of the editor itself
+    if (!config.documentPath.empty() || !config.sessionPath.empty()) {
+        if (!config.documentPath.empty() && !writeFile(config.documentPath, generateDocument(config.pages, config.headingsPerPage))) {
+            fprintf(stderr, "Could not write %s\n", config.documentPath.c_str());
+            return 1;
+        }
+        if (!config.sessionPath.empty() &&
+            !writeFile(config.sessionPath, encodeKeyScript(generateSession(max(1, config.sessionKeys), config.pages)))) {
+            fprintf(stderr, "Could not write %s\n", config.sessionPath.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    benchmarkTextLayout(config);
+    benchmarkDocument(config);
+    benchmarkParallelSearch(config);
+    benchmarkCipherAndFiles(config);
+    benchmarkHistory(config);
+    benchmarkSession(config);
+    benchmarkExport(config);
+    benchmarkCompare(config);
+
+    if (config.jsonPath == "-") writeJsonReport(stdout, config);
+    else if (!config.jsonPath.empty()) {
+        FILE* out = fopen(config.jsonPath.c_str(), "w");
+        if (out == nullptr) { fprintf(stderr, "Could not write %s\n", config.jsonPath.c_str()); return 1; }
+        writeJsonReport(out, config);
+        fclose(out);
+    }
+
+    closeAllDocuments();
+    destroyPagePool();
+    return 0;
+}
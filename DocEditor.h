@@ -2,11 +2,218 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#ifdef _WIN32
 #include <windows.h>
 #include <conio.h>
+#else
+#include <termios.h>
+#include <unistd.h>
+#include <sys/select.h>
+#endif
+#include <vector>
+#include <array>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <deque>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <new>
 
 using namespace std;
 
+/**
+ * Performance Instrumentation
+ * PERF_SCOPE(metric, bytes) times the rest of the enclosing block. While
+ * profiling is off a probe costs one relaxed atomic load; defining
+ * DOCEDITOR_NO_PERF compiles the probes and the allocation hook out.
+ * The allocation hook replaces the global operator new/delete, so it is
+ * only compiled where DOCEDITOR_ALLOCATION_HOOK is defined before this
+ * header is included: once per program, in the editor's and the
+ * benchmark's main file. Elsewhere allocations are not counted.
+ * Results are shown by handlePerfStatsView() and can be exported as a
+ * Chrome trace (chrome://tracing, Perfetto).
+ */
+enum PerfMetric {
+    PERF_DISPLAY_PAGE, PERF_PROCESS_PARAGRAPH, PERF_SERIALIZE, PERF_DESERIALIZE,
+    PERF_ENCRYPT, PERF_DECRYPT, PERF_SEARCH_PAGE, PERF_SEARCH_DOCUMENT,
+    PERF_READ_FILE, PERF_WRITE_FILE, PERF_TOC_VIEW, PERF_EXPORT_PAGE,
+    PERF_COMPARE, PERF_METRIC_COUNT
+};
+
+const char* perfMetricNames[PERF_METRIC_COUNT] = {
+    "displayPageContent", "processParagraph", "serializeDocument", "deserializeDocument",
+    "encrypt", "decrypt", "searchAndHighlight", "searchDocument",
+    "readFile", "writeFile", "handleTOCView", "exportPage",
+    "compareDocuments"
+};
+
+const int perf_samples_per_metric = 4096; // Recent durations kept for p50/p99
+const int perf_trace_capacity = 1 << 16;  // Most recent trace events kept
+
+struct PerfStats {
+    atomic<long long> calls;
+    atomic<long long> totalNs;
+    atomic<long long> maxNs;
+    atomic<long long> bytes;
+    atomic<long long> allocations;
+    mutex sampleLock;
+    vector<long long> samples; // Ring buffer of durations (ns)
+    int nextSample;
+
+    PerfStats() : calls(0), totalNs(0), maxNs(0), bytes(0), allocations(0), nextSample(0) {}
+};
+
+struct PerfEvent {
+    int metric;
+    int threadId;
+    long long startNs;
+    long long durationNs;
+};
+
+atomic<bool> perfEnabled(false);
+PerfStats perfStats[PERF_METRIC_COUNT];
+mutex perfTraceLock;
+vector<PerfEvent> perfTrace;
+long long perfTraceNext = 0;
+atomic<int> perfThreadCount(0);
+thread_local int perfThreadId = -1;
+thread_local long long threadAllocationCount = 0;
+const chrono::steady_clock::time_point perfEpoch = chrono::steady_clock::now();
+
+#if defined(DOCEDITOR_ALLOCATION_HOOK) && !defined(DOCEDITOR_NO_PERF)
+const bool allocationCountingEnabled = true;
+
+// Counts allocations per thread so probes can report allocations per call.
+// Kept out of line so GCC does not pair the inlined malloc/free with new/delete.
+#if defined(__GNUC__)
+#define PERF_NOINLINE __attribute__((noinline))
+#else
+#define PERF_NOINLINE
+#endif
+PERF_NOINLINE void* operator new(size_t size) {
+    threadAllocationCount++;
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) throw bad_alloc();
+    return p;
+}
+
+PERF_NOINLINE void operator delete(void* p) noexcept { free(p); }
+PERF_NOINLINE void operator delete(void* p, size_t) noexcept { free(p); }
+#else
+const bool allocationCountingEnabled = false;
+#endif
+
+long long perfNowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - perfEpoch).count();
+}
+
+void recordPerfSample(int metric, long long startNs, long long durationNs, long long bytes, long long allocations) {
+    PerfStats& stats = perfStats[metric];
+    stats.calls++;
+    stats.totalNs += durationNs;
+    stats.bytes += bytes;
+    stats.allocations += allocations;
+    long long seenMax = stats.maxNs.load();
+    while (durationNs > seenMax && !stats.maxNs.compare_exchange_weak(seenMax, durationNs)) {}
+    {
+        lock_guard<mutex> guard(stats.sampleLock);
+        if ((int)stats.samples.size() < perf_samples_per_metric) stats.samples.push_back(durationNs);
+        else stats.samples[stats.nextSample] = durationNs;
+        stats.nextSample = (stats.nextSample + 1) % perf_samples_per_metric;
+    }
+    if (perfThreadId < 0) perfThreadId = perfThreadCount++;
+    PerfEvent event;
+    event.metric = metric; event.threadId = perfThreadId;
+    event.startNs = startNs; event.durationNs = durationNs;
+    lock_guard<mutex> guard(perfTraceLock);
+    if ((int)perfTrace.size() < perf_trace_capacity) perfTrace.push_back(event);
+    else perfTrace[perfTraceNext % perf_trace_capacity] = event;
+    perfTraceNext++;
+}
+
+struct PerfScope {
+    int metric;
+    long long bytes;
+    bool active;
+    long long startNs;
+    long long startAllocations;
+
+    PerfScope(PerfMetric perfMetric, long long byteCount)
+        : metric(perfMetric), bytes(byteCount), active(perfEnabled.load(memory_order_relaxed)), startNs(0), startAllocations(0) {
+        if (active) {
+            startNs = perfNowNs();
+            startAllocations = threadAllocationCount;
+        }
+    }
+
+    ~PerfScope() {
+        if (active) recordPerfSample(metric, startNs, perfNowNs() - startNs, bytes, threadAllocationCount - startAllocations);
+    }
+};
+
+#ifdef DOCEDITOR_NO_PERF
+#define PERF_SCOPE(metric, bytes)
+#else
+#define PERF_SCOPE(metric, bytes) PerfScope perfScope(metric, bytes)
+#endif
+
+void resetPerfStats() {
+    for (int m = 0; m < PERF_METRIC_COUNT; ++m) {
+        PerfStats& stats = perfStats[m];
+        stats.calls = 0; stats.totalNs = 0; stats.maxNs = 0; stats.bytes = 0; stats.allocations = 0;
+        lock_guard<mutex> guard(stats.sampleLock);
+        stats.samples.clear();
+        stats.nextSample = 0;
+    }
+    lock_guard<mutex> guard(perfTraceLock);
+    perfTrace.clear();
+    perfTraceNext = 0;
+}
+
+// Percentile (0-100) of the recent samples of one metric, in nanoseconds
+long long getPerfPercentile(int metric, int percentile) {
+    vector<long long> samples;
+    {
+        lock_guard<mutex> guard(perfStats[metric].sampleLock);
+        samples = perfStats[metric].samples;
+    }
+    if (samples.empty()) return 0;
+    size_t rank = (samples.size() - 1) * percentile / 100;
+    nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
+// Writes the recorded events in Chrome trace-event JSON format
+bool exportPerfTrace(const string& filename) {
+    vector<PerfEvent> events;
+    {
+        lock_guard<mutex> guard(perfTraceLock);
+        events = perfTrace;
+    }
+    sort(events.begin(), events.end(), [](const PerfEvent& a, const PerfEvent& b) { return a.startNs < b.startNs; });
+    ofstream file(filename.c_str(), ios::binary);
+    if (!file.is_open()) return false;
+    file << "{\"traceEvents\":[\n";
+    for (size_t i = 0; i < events.size(); ++i) {
+        file << "{\"name\":\"" << perfMetricNames[events[i].metric] << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << events[i].threadId
+            << ",\"ts\":" << events[i].startNs / 1000.0 << ",\"dur\":" << events[i].durationNs / 1000.0 << "}";
+        if (i + 1 < events.size()) file << ",";
+        file << "\n";
+    }
+    file << "],\"displayTimeUnit\":\"ms\"}\n";
+    file.close();
+    return !file.fail();
+}
+
 /**
  * Editor Layout Configuration
  * Defines the dimensions and positioning for the console UI.
@@ -18,17 +225,105 @@ const int col1_start_X = 3;
 const int col2_start_X = col1_start_X + col_width + 3;
 const int page_end_X = col2_start_X + col_width + 3;
 const int STATUS_BAR_Y = page_start_Y + page_height + 2;
+const int STATS_BAR_Y = STATUS_BAR_Y - 1; // Document totals, drawn with the status bar
 
 // Storage limit: Each page holds two columns (Total lines = height * 2)
 const int MAX_LINES_PER_PAGE_STORAGE = page_height * 2;
 
+/**
+ * HeadingEntry Structure
+ * One '#' heading found on a page. Level is the number of leading '#'.
+ */
+struct HeadingEntry {
+    int line;
+    int level;
+    string title;
+};
+
+/**
+ * PageStats Structure
+ * Word and character counts of one page, kept current by indexPage().
+ */
+struct PageStats {
+    int words;
+    int characters;
+};
+
+/**
+ * PageSlab Structure
+ * Line storage for one page: every line's bytes sit back to back in text,
+ * line i spans [lineStart(i), lineEnd[i]). Slabs are reference counted and
+ * treated as immutable once shared, so a page, its undo/redo entries and the
+ * plain copy kept while the document is scrambled can all point at the same
+ * slab until one of them writes.
+ */
+struct PageSlab {
+    string text;
+    int lineEnd[MAX_LINES_PER_PAGE_STORAGE];
+    int refCount;
+    PageSlab* nextFree;
+
+    PageSlab() : refCount(0), nextFree(nullptr) {
+        clear();
+    }
+
+    // Empties every line but keeps the capacity for reuse
+    void clear() {
+        text.clear();
+        for (int i = 0; i < MAX_LINES_PER_PAGE_STORAGE; ++i) lineEnd[i] = 0;
+    }
+
+    int lineStart(int line) const { return (line == 0) ? 0 : lineEnd[line - 1]; }
+    int lineLength(int line) const { return lineEnd[line] - lineStart(line); }
+};
+
+/**
+ * Slab Pool
+ * Slabs are carved out of fixed-size blocks and recycled through a free list
+ * when their last reference is released.
+ */
+const int slab_pool_block_size = 256;
+vector<PageSlab*> slabPoolBlocks;
+PageSlab* freeSlabList = nullptr;
+int slabsAllocatedFromSystem = 0;
+
+PageSlab* acquireSlab() {
+    if (freeSlabList == nullptr) {
+        PageSlab* block = new PageSlab[slab_pool_block_size];
+        slabPoolBlocks.push_back(block);
+        slabsAllocatedFromSystem += slab_pool_block_size;
+        for (int i = slab_pool_block_size - 1; i >= 0; --i) {
+            block[i].nextFree = freeSlabList;
+            freeSlabList = &block[i];
+        }
+    }
+    PageSlab* slab = freeSlabList;
+    freeSlabList = slab->nextFree;
+    slab->clear();
+    slab->refCount = 1;
+    return slab;
+}
+
+PageSlab* retainSlab(PageSlab* slab) {
+    if (slab != nullptr) slab->refCount++;
+    return slab;
+}
+
+void releaseSlab(PageSlab* slab) {
+    if (slab == nullptr) return;
+    if (--slab->refCount == 0) {
+        slab->nextFree = freeSlabList;
+        freeSlabList = slab;
+    }
+}
+
 /**
  * DocumentPage Structure
  * Linked list node representing a single page in the document.
  */
 struct DocumentPage {
-    // Array to store individual lines of text
-    string content[MAX_LINES_PER_PAGE_STORAGE];
+    // Line storage, shared copy-on-write with snapshots (see PageSlab)
+    PageSlab* slab;
 
     // Linked list pointers for navigation
     DocumentPage* next;
@@ -37,93 +332,428 @@ struct DocumentPage {
     // Unique index for mapping Undo/Redo operations
     int pageIndex;
 
-    DocumentPage(int index = 0) : next(nullptr), prev(nullptr), pageIndex(index) {
-        // Initialize all lines as empty strings
-        for (int i = 0; i < MAX_LINES_PER_PAGE_STORAGE; ++i) {
-            content[i] = "";
+    // Headings on this page, kept in line order by indexPageHeadings()
+    vector<HeadingEntry> headings;
+
+    // Counts last added to the document totals by indexPageStats()
+    PageStats stats;
+
+    // hashPageSlab() of the slab, set by indexPage(); 0 for an empty page
+    unsigned long long contentHash;
+
+    DocumentPage(int index = 0) : slab(nullptr), next(nullptr), prev(nullptr), pageIndex(index), stats(), contentHash(0) {}
+
+    int lineStart(int line) const { return slab->lineStart(line); }
+    int lineLength(int line) const { return slab->lineLength(line); }
+    bool isLineEmpty(int line) const { return slab->lineLength(line) == 0; }
+    string getLine(int line) const { return slab->text.substr(lineStart(line), lineLength(line)); }
+
+    // Gives the page a slab it may modify, copying it first if it is shared
+    PageSlab* writableSlab() {
+        if (slab->refCount > 1) {
+            PageSlab* copy = acquireSlab();
+            copy->text = slab->text;
+            for (int i = 0; i < MAX_LINES_PER_PAGE_STORAGE; ++i) copy->lineEnd[i] = slab->lineEnd[i];
+            releaseSlab(slab);
+            slab = copy;
+        }
+        return slab;
+    }
+
+    // Gives the page an empty slab to fill, without copying shared content
+    PageSlab* rewriteSlab() {
+        if (slab->refCount > 1) {
+            releaseSlab(slab);
+            slab = acquireSlab();
+        }
+        else {
+            slab->clear();
         }
+        return slab;
+    }
+
+    void setLine(int line, const string& value) {
+        PageSlab* target = writableSlab();
+        int start = target->lineStart(line);
+        int oldLength = target->lineEnd[line] - start;
+        target->text.replace(start, oldLength, value);
+        int delta = (int)value.length() - oldLength;
+        for (int i = line; i < MAX_LINES_PER_PAGE_STORAGE; ++i) target->lineEnd[i] += delta;
     }
 };
 
-// Global pointers and counters
-DocumentPage* headPage = nullptr;
-DocumentPage* currentPagePtr = nullptr;
-int nextPageGlobalIndex = 0;
+/**
+ * FenwickTree Structure
+ * Prefix sums over per-page counts. Supports appending pages, point updates
+ * and "which page holds the k-th item" lookups, all in O(log pages).
+ */
+struct FenwickTree {
+    vector<long long> tree; // 1-based, tree[0] unused
+
+    FenwickTree() : tree(1, 0) {}
+
+    int size() const { return (int)tree.size() - 1; }
+
+    void clear() { tree.assign(1, 0); }
+
+    void reserve(int count) { tree.reserve(count + 1); }
+
+    void pushBack(long long value) {
+        int i = (int)tree.size();
+        long long node = value;
+        for (int step = 1; step < (i & -i); step <<= 1) node += tree[i - step];
+        tree.push_back(node);
+    }
+
+    void add(int index, long long delta) {
+        for (int i = index + 1; i < (int)tree.size(); i += (i & -i)) tree[i] += delta;
+    }
+
+    // Sum of entries [0, count)
+    long long prefix(int count) const {
+        long long sum = 0;
+        for (int i = count; i > 0; i -= (i & -i)) sum += tree[i];
+        return sum;
+    }
+
+    long long total() const { return prefix(size()); }
 
-// History Management: Fixed arrays for Undo/Redo (supports up to 100 pages)
+    // Index of the entry containing the k-th (0-based) item, or -1 if k >= total
+    int findKth(long long k) const {
+        if (k < 0) return -1;
+        int pos = 0, n = size();
+        int mask = 1;
+        while ((mask << 1) <= n) mask <<= 1;
+        for (; mask > 0; mask >>= 1) {
+            int next = pos + mask;
+            if (next <= n && tree[next] <= k) {
+                pos = next;
+                k -= tree[next];
+            }
+        }
+        return (pos < n) ? pos : -1;
+    }
+};
+
+// History Management: Fixed-depth Undo/Redo stacks, one slot per page index
 const int history_depth = 10;
-string undoStack[100][history_depth];
-string redoStack[100][history_depth];
-int undoTop[100];
-int redoTop[100];
 
 // Formatting and Search Constants
 const char DELIMITER = '\n';
 const int search_history_size = 5;
 
-// Search History Tracking
-string recentSearches[search_history_size];
-int recentCount[search_history_size];
-int searchHistoryTop = 0;
-int searchHistoryTotal = 0;
+/**
+ * Document Structure
+ * Everything that belongs to one open document: its pages and page index,
+ * undo/redo history, search history and highlight, and encryption state.
+ * Editor code works on activeDoc; the session (see Document Session) keeps
+ * the other open documents and swaps activeDoc between them.
+ */
+struct Document {
+    int id;
+    string name;
+
+    // Page list and cursor
+    DocumentPage* headPage;
+    DocumentPage* currentPagePtr;
+    int nextPageGlobalIndex;
+
+    // Bumped on every change to page content; background results check it before applying
+    int documentVersion;
+
+    // Page Index: pages in list order (O(1) jumps) plus per-page heading,
+    // word and character counts
+    vector<DocumentPage*> pageTable;
+    FenwickTree headingCounts;
+    FenwickTree wordCounts;
+    FenwickTree characterCounts;
+
+    // Undo/Redo slots, one per page index
+    vector<array<PageSlab*, history_depth>> undoStack;
+    vector<array<PageSlab*, history_depth>> redoStack;
+    vector<int> undoTop;
+    vector<int> redoTop;
+
+    // Search History Tracking
+    string recentSearches[search_history_size];
+    int recentCount[search_history_size];
+    int searchHistoryTop;
+    int searchHistoryTotal;
+
+    // Active highlight state used by displayPageContent()
+    string currentSearchTerm;
+    bool isSearchMode;
+
+    // Encryption state; while scrambled the plain pages are kept as snapshots
+    bool isEncrypted;
+    string encryptionKey;
+    vector<PageSlab*> plainSnapshot;
+    string cipherImage; // Exact cipher bytes; the page view of them is display-only
+
+    // Session bookkeeping
+    long long lastUsed;   // Session clock value when last made active
+    bool isEvicted;       // Pages released, content in swapPath
+    string swapPath;
+    int evictedPageNumber; // Page to return to after a restore
+
+    Document(int documentId, string documentName)
+        : id(documentId), name(documentName), headPage(nullptr), currentPagePtr(nullptr), nextPageGlobalIndex(0),
+        documentVersion(0), searchHistoryTop(0), searchHistoryTotal(0), currentSearchTerm(""), isSearchMode(false),
+        isEncrypted(false), encryptionKey(""), lastUsed(0), isEvicted(false), swapPath(""), evictedPageNumber(1) {
+        for (int i = 0; i < search_history_size; ++i) recentCount[i] = 0;
+    }
+};
+
+Document* activeDoc = new Document(1, "Untitled 1"); // Owned by sessionDocuments
+
+// Makes doc the active document for the lifetime of the scope (UI thread only)
+struct ActiveDocumentScope {
+    Document* saved;
+    ActiveDocumentScope(Document* doc) : saved(activeDoc) { activeDoc = doc; }
+    ~ActiveDocumentScope() { activeDoc = saved; }
+};
+
+void markDocumentChanged() {
+    activeDoc->documentVersion++;
+}
 
 // Editor State Flags
 int currentAlignment = 0; // 0: Left, 1: Right, 2: Center, 3: Justify
-bool isEncrypted = false;
-string encryptionKey = "";
 
 const char PAGE_DELIMITER = '\r';
+const int toc_entries_per_screen = page_height;
 const unsigned char CHECKSUM_MAGIC = 0xA9;
 
+// Serialized format: documents start with document_format_magic, and any line
+// byte that would read as a delimiter (or the escape byte itself) is written
+// as ESCAPE_BYTE followed by the byte XOR escape_flip. Text without the magic
+// is parsed the legacy way, unescaped.
+const char ESCAPE_BYTE = 0x10;
+const char escape_flip = 0x40;
+const string document_format_magic = string(1, ESCAPE_BYTE) + "DOC2";
+
 /**
  * Helper to calculate the 1-based display number of a page
+ * Pages are only ever appended, so a page's slot in pageTable is its position.
  */
 int getPageDisplayNumber(DocumentPage* page) {
     if (page == nullptr) return 0;
-    int count = 1;
-    DocumentPage* current = headPage;
-    while (current != nullptr && current != page) {
-        current = current->next;
-        count++;
+    int index = page->pageIndex;
+    if (index >= 0 && index < (int)activeDoc->pageTable.size() && activeDoc->pageTable[index] == page) return index + 1;
+    return -1;
+}
+
+/**
+ * Page Pool (Arena Allocator)
+ * Pages are carved out of fixed-size blocks and recycled through a free list.
+ * Together with the slab pool this means rebuilding the whole document (load,
+ * encrypt, decrypt) reuses memory instead of going back to the general
+ * allocator for every page.
+ */
+const int page_pool_block_size = 256;
+vector<DocumentPage*> pagePoolBlocks;
+DocumentPage* freePageList = nullptr;
+int pagesAllocatedFromSystem = 0;
+
+DocumentPage* acquirePage(int index) {
+    if (freePageList == nullptr) {
+        DocumentPage* block = new DocumentPage[page_pool_block_size];
+        pagePoolBlocks.push_back(block);
+        pagesAllocatedFromSystem += page_pool_block_size;
+        for (int i = page_pool_block_size - 1; i >= 0; --i) {
+            block[i].next = freePageList;
+            freePageList = &block[i];
+        }
+    }
+    DocumentPage* page = freePageList;
+    freePageList = page->next;
+
+    page->slab = acquireSlab();
+    page->headings.clear();
+    page->stats = PageStats();
+    page->contentHash = 0;
+    page->next = nullptr;
+    page->prev = nullptr;
+    page->pageIndex = index;
+    return page;
+}
+
+void releasePage(DocumentPage* page) {
+    if (page == nullptr) return;
+    releaseSlab(page->slab);
+    page->slab = nullptr;
+    page->prev = nullptr;
+    page->next = freePageList;
+    freePageList = page;
+}
+
+// Returns every page of the document to the pool and resets the list
+void releaseAllPages() {
+    DocumentPage* current = activeDoc->headPage;
+    while (current != nullptr) {
+        DocumentPage* next = current->next;
+        releasePage(current);
+        current = next;
     }
-    return (current == page) ? count : -1;
+    activeDoc->headPage = nullptr;
+    activeDoc->currentPagePtr = nullptr;
+}
+
+// Hands the pool's memory back to the system (shutdown only)
+void destroyPagePool() {
+    for (int i = 0; i < (int)pagePoolBlocks.size(); ++i) delete[] pagePoolBlocks[i];
+    pagePoolBlocks.clear();
+    freePageList = nullptr;
+    pagesAllocatedFromSystem = 0;
+
+    for (int i = 0; i < (int)slabPoolBlocks.size(); ++i) delete[] slabPoolBlocks[i];
+    slabPoolBlocks.clear();
+    freeSlabList = nullptr;
+    slabsAllocatedFromSystem = 0;
+}
+
+/**
+ * Constant-time lookup of a page by its 1-based display number
+ */
+DocumentPage* getPageByNumber(int pageNumber) {
+    if (pageNumber < 1 || pageNumber > (int)activeDoc->pageTable.size()) return nullptr;
+    return activeDoc->pageTable[pageNumber - 1];
+}
+
+int getPageCount() {
+    return (int)activeDoc->pageTable.size();
 }
 
 /**
  * Creates and appends a new page to the linked list
  */
 DocumentPage* addNewPage() {
-    // Limit check for fixed Undo/Redo array size
-    if (nextPageGlobalIndex >= 100) return nullptr;
+    DocumentPage* newPage = acquirePage(activeDoc->nextPageGlobalIndex);
+    activeDoc->nextPageGlobalIndex++;
 
-    DocumentPage* newPage = new DocumentPage(nextPageGlobalIndex);
-    nextPageGlobalIndex++;
+    // Grow the per-page history slots the first time an index is used
+    while ((int)activeDoc->undoTop.size() < activeDoc->nextPageGlobalIndex) {
+        activeDoc->undoStack.emplace_back();
+        activeDoc->redoStack.emplace_back();
+        activeDoc->undoTop.push_back(-1);
+        activeDoc->redoTop.push_back(-1);
+    }
 
-    if (headPage == nullptr) {
-        headPage = newPage;
+    if (activeDoc->headPage == nullptr) {
+        activeDoc->headPage = newPage;
     }
     else {
-        DocumentPage* lastPage = headPage;
-        while (lastPage->next != nullptr) {
-            lastPage = lastPage->next;
-        }
+        DocumentPage* lastPage = activeDoc->pageTable.back();
         lastPage->next = newPage;
         newPage->prev = lastPage;
     }
+    activeDoc->pageTable.push_back(newPage);
+    activeDoc->headingCounts.pushBack(0);
+    activeDoc->wordCounts.pushBack(0);
+    activeDoc->characterCounts.pushBack(0);
+    markDocumentChanged(); // Background results built from an older snapshot lack this page
     return newPage;
 }
 
+// Sizes the per-page tables up front so appending pageCount pages never reallocates them
+void reserveDocumentPages(int pageCount) {
+    activeDoc->pageTable.reserve(pageCount);
+    activeDoc->headingCounts.reserve(pageCount);
+    activeDoc->wordCounts.reserve(pageCount);
+    activeDoc->characterCounts.reserve(pageCount);
+    activeDoc->undoStack.reserve(pageCount);
+    activeDoc->redoStack.reserve(pageCount);
+    activeDoc->undoTop.reserve(pageCount);
+    activeDoc->redoTop.reserve(pageCount);
+}
+
 /**
- * Windows Console Management Functions
+ * Page Index (Incremental Table of Contents and Statistics)
+ * Each page keeps its own heading list and word/character counts; the
+ * Fenwick trees aggregate them, so the TOC can locate any entry and the
+ * status bar can show document totals without rescanning the document.
+ * indexPage() is called wherever a page's content is replaced: paragraph
+ * input, undo/redo and loading (see Page Statistics for the counting). It
+ * also refreshes the page's content hash (see Page Content Hashes).
  */
-void gotoxy(int x, int y) {
+int getHeadingLevel(const string& line) {
+    int level = 0;
+    while (level < (int)line.length() && line[level] == '#') level++;
+    return level;
+}
+
+// Appends the slab's headings in line order; reads only the slab, so worker-safe
+void collectSlabHeadings(const PageSlab* slab, vector<HeadingEntry>& out) {
+    for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) {
+        if (slab->lineLength(l) == 0 || slab->text[slab->lineStart(l)] != '#') continue;
+        string line = slab->text.substr(slab->lineStart(l), slab->lineLength(l));
+        int level = getHeadingLevel(line);
+        HeadingEntry entry;
+        entry.line = l;
+        entry.level = level;
+        entry.title = line.substr(level);
+        out.push_back(entry);
+    }
+}
+
+void indexPageHeadings(DocumentPage* page) {
+    if (page == nullptr) return;
+    int oldCount = (int)page->headings.size();
+    page->headings.clear();
+    collectSlabHeadings(page->slab, page->headings);
+    int delta = (int)page->headings.size() - oldCount;
+    if (delta != 0 && page->pageIndex < activeDoc->headingCounts.size()) activeDoc->headingCounts.add(page->pageIndex, delta);
+}
+
+void clearPageIndex() {
+    activeDoc->pageTable.clear();
+    activeDoc->headingCounts.clear();
+    activeDoc->wordCounts.clear();
+    activeDoc->characterCounts.clear();
+}
+
+long long getWordTotal() {
+    return activeDoc->wordCounts.total();
+}
+
+long long getCharacterTotal() {
+    return activeDoc->characterCounts.total();
+}
+
+// Page holding the wordNumber-th (1-based) word, or nullptr past the end
+DocumentPage* findPageOfWord(long long wordNumber) {
+    int pageIdx = activeDoc->wordCounts.findKth(wordNumber - 1);
+    if (pageIdx < 0 || pageIdx >= (int)activeDoc->pageTable.size()) return nullptr;
+    return activeDoc->pageTable[pageIdx];
+}
+
+int getHeadingTotal() {
+    return (int)activeDoc->headingCounts.total();
+}
+
+// Finds the page and in-page slot of the k-th heading in document order
+DocumentPage* locateHeading(int k, int& slot) {
+    int pageIdx = activeDoc->headingCounts.findKth(k);
+    if (pageIdx < 0 || pageIdx >= (int)activeDoc->pageTable.size()) return nullptr;
+    slot = k - (int)activeDoc->headingCounts.prefix(pageIdx);
+    return activeDoc->pageTable[pageIdx];
+}
+
+/**
+ * Console Management Functions
+ * Windows uses the console API; other platforms (Linux builds of the
+ * benchmarks) use ANSI escape sequences and a raw-mode terminal. The
+ * headless screen below replaces both during scripted replays.
+ */
+#ifdef _WIN32
+void platformGotoxy(int x, int y) {
     COORD coord;
     coord.X = x;
     coord.Y = y;
     SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), coord);
 }
 
-void hideCursor() {
+void platformHideCursor() {
     HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
     CONSOLE_CURSOR_INFO info;
     info.dwSize = 100;
@@ -131,7 +761,7 @@ void hideCursor() {
     SetConsoleCursorInfo(consoleHandle, &info);
 }
 
-void showCursor() {
+void platformShowCursor() {
     HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
     CONSOLE_CURSOR_INFO info;
     info.dwSize = 10;
@@ -139,13 +769,276 @@ void showCursor() {
     SetConsoleCursorInfo(consoleHandle, &info);
 }
 
+void platformClearScreen() {
+    system("cls");
+}
+
+void platformSetHighlightColor() {
+    SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_INTENSITY);
+}
+
+void platformResetTextColor() {
+    SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+}
+#else
+void platformGotoxy(int x, int y) {
+    cout << "\x1b[" << (y + 1) << ';' << (x + 1) << 'H';
+}
+
+void platformHideCursor() {
+    cout << "\x1b[?25l" << flush;
+}
+
+void platformShowCursor() {
+    cout << "\x1b[?25h" << flush;
+}
+
+void platformClearScreen() {
+    cout << "\x1b[2J\x1b[H";
+}
+
+void platformSetHighlightColor() {
+    cout << "\x1b[30;103m";
+}
+
+void platformResetTextColor() {
+    cout << "\x1b[0m";
+}
+
+// The terminal stays in raw mode (no echo, no line buffering) from the first
+// key read until exit, matching how _getch() behaves on Windows
+termios savedTerminal;
+bool rawInputEnabled = false;
+
+void restoreTerminal() {
+    tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
+}
+
+void enableRawInput() {
+    if (rawInputEnabled || !isatty(STDIN_FILENO)) return;
+    rawInputEnabled = true;
+    tcgetattr(STDIN_FILENO, &savedTerminal);
+    termios raw = savedTerminal;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_iflag &= ~ICRNL; // Enter arrives as 13, as on Windows
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    atexit(restoreTerminal);
+}
+
+int _getch() {
+    enableRawInput();
+    cout << flush;
+    unsigned char c = 0;
+    if (read(STDIN_FILENO, &c, 1) != 1) return 27; // End of input behaves like Esc
+    if (c == 127) return 8;                         // Backspace
+    return c;
+}
+
+int _kbhit() {
+    enableRawInput();
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(STDIN_FILENO, &readSet);
+    timeval timeout = { 0, 0 };
+    return select(STDIN_FILENO + 1, &readSet, nullptr, nullptr, &timeout) > 0;
+}
+#endif
+
+/**
+ * Headless Screen
+ * An in-memory character grid that stands in for the console: cout is
+ * redirected into it and gotoxy() moves its cursor, so a replayed session
+ * pays for the same layout and output work without a terminal.
+ */
+const int headless_screen_width = 120;
+const int headless_screen_height = 50;
+
+struct ScreenBuffer : streambuf {
+    vector<string> rows;
+    int cursorX;
+    int cursorY;
+
+    ScreenBuffer() : rows(headless_screen_height, string(headless_screen_width, ' ')), cursorX(0), cursorY(0) {}
+
+    void clear() {
+        for (int y = 0; y < headless_screen_height; ++y) rows[y].assign(headless_screen_width, ' ');
+        cursorX = 0; cursorY = 0;
+    }
+
+    void moveTo(int x, int y) { cursorX = x; cursorY = y; }
+
+    void put(char c) {
+        if (c == '\n') { cursorX = 0; cursorY++; return; }
+        if (c == '\b') { if (cursorX > 0) cursorX--; return; }
+        if (cursorY >= 0 && cursorY < headless_screen_height && cursorX >= 0 && cursorX < headless_screen_width) rows[cursorY][cursorX] = c;
+        cursorX++;
+    }
+
+    int overflow(int c) override {
+        if (c != EOF) put((char)c);
+        return c;
+    }
+
+    streamsize xsputn(const char* text, streamsize count) override {
+        for (streamsize i = 0; i < count; ++i) put(text[i]);
+        return count;
+    }
+
+    string dump() const {
+        string out;
+        for (int y = 0; y < headless_screen_height; ++y) {
+            size_t end = rows[y].find_last_not_of(' ');
+            out += (end == string::npos) ? "" : rows[y].substr(0, end + 1);
+            out += '\n';
+        }
+        return out;
+    }
+};
+
+ScreenBuffer headlessScreen;
+bool isHeadless = false;
+streambuf* consoleBuffer = nullptr;
+
+void enableHeadlessScreen() {
+    if (isHeadless) return;
+    consoleBuffer = cout.rdbuf(&headlessScreen);
+    isHeadless = true;
+}
+
+void disableHeadlessScreen() {
+    if (!isHeadless) return;
+    cout.rdbuf(consoleBuffer);
+    isHeadless = false;
+}
+
+void gotoxy(int x, int y) {
+    if (isHeadless) headlessScreen.moveTo(x, y);
+    else platformGotoxy(x, y);
+}
+
+void hideCursor() { if (!isHeadless) platformHideCursor(); }
+void showCursor() { if (!isHeadless) platformShowCursor(); }
+void setHighlightColor() { if (!isHeadless) platformSetHighlightColor(); }
+void resetTextColor() { if (!isHeadless) platformResetTextColor(); }
+
+void clearScreen() {
+    if (isHeadless) headlessScreen.clear();
+    else platformClearScreen();
+}
+
+/**
+ * Input Source
+ * Every key the editor reads goes through readKey()/keyAvailable(). They
+ * normally read the console; a replay feeds keys from a recorded script
+ * instead, and recording saves what was typed as such a script.
+ */
+bool isReplayingInput = false;
+string replayKeys;
+size_t replayPosition = 0;
+bool replayKeyPending = false; // A replayed key is being handled (its latency is open)
+int replayOverrun = 0;
+chrono::steady_clock::time_point replayKeyTime;
+vector<long long> replayLatencyNs; // Per key: from reading it until the editor asked for the next one
+
+bool isRecordingInput = false;
+string recordedKeys;
+
+// Closes the latency measurement of the key being handled, if any
+void finishReplayKey() {
+    if (!replayKeyPending) return;
+    replayLatencyNs.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - replayKeyTime).count());
+    replayKeyPending = false;
+}
+
+bool isReplayFinished() {
+    return isReplayingInput && replayPosition >= replayKeys.size();
+}
+
+int readKey() {
+    if (!isReplayingInput) {
+        int key = _getch();
+        if (isRecordingInput) recordedKeys += (char)key;
+        return key;
+    }
+    finishReplayKey();
+    if (replayPosition < replayKeys.size()) {
+        replayKeyPending = true;
+        replayKeyTime = chrono::steady_clock::now();
+        return (unsigned char)replayKeys[replayPosition++];
+    }
+    // Past the end of the script Enter and Esc alternate, so any open prompt closes
+    return (replayOverrun++ & 1) ? 27 : 13;
+}
+
+bool keyAvailable() {
+    if (isReplayingInput) return replayPosition < replayKeys.size();
+    return _kbhit() != 0;
+}
+
+/**
+ * Key Scripts
+ * Printable characters stand for themselves; \r is Enter, \b Backspace,
+ * \e Esc, \\ a backslash and \xHH any other byte. Line breaks in the file
+ * are only layout and are ignored.
+ */
+string encodeKeyScript(const string& keys) {
+    string out;
+    for (size_t i = 0; i < keys.length(); ++i) {
+        unsigned char c = keys[i];
+        if (c == 13) out += "\\r\n";
+        else if (c == 8) out += "\\b";
+        else if (c == 27) out += "\\e";
+        else if (c == '\\') out += "\\\\";
+        else if (c >= 32 && c < 127) out += (char)c;
+        else {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\x%02X", c);
+            out += buffer;
+        }
+    }
+    return out;
+}
+
+// Returns false on a malformed escape
+bool decodeKeyScript(const string& script, string& keys) {
+    keys.clear();
+    for (size_t i = 0; i < script.length(); ++i) {
+        char c = script[i];
+        if (c == '\n' || c == '\r') continue;
+        if (c != '\\') { keys += c; continue; }
+        if (++i >= script.length()) return false;
+        switch (script[i]) {
+        case 'r': keys += (char)13; break;
+        case 'b': keys += (char)8; break;
+        case 'e': keys += (char)27; break;
+        case '\\': keys += '\\'; break;
+        case 'x': {
+            if (i + 2 >= script.length()) return false;
+            string hex = script.substr(i + 1, 2);
+            if (hex.find_first_not_of("0123456789abcdefABCDEF") != string::npos) return false;
+            keys += (char)strtol(hex.c_str(), nullptr, 16);
+            i += 2;
+            break;
+        }
+        default: return false;
+        }
+    }
+    return true;
+}
+
 /**
  * Draws the visual framework of the editor
  */
 void drawEditorUI(int currentPage) {
-    system("cls");
+    clearScreen();
     gotoxy(col1_start_X, 0);
     cout << "OUR FAST - WORD Editor (Welcome) ";
+    string name = activeDoc->name;
+    if (name.length() > 24) name = name.substr(0, 21) + "...";
+    gotoxy(col2_start_X, 0);
+    cout << name;
     gotoxy(page_end_X - 12, 0);
     cout << "Page: " << currentPage;
     gotoxy(col1_start_X, page_start_Y - 1);
@@ -175,13 +1068,26 @@ string getAlignmentName() {
     return "LEFT";
 }
 
+// Document totals come from the page index, so drawing them is O(log pages)
+void drawDocumentStats() {
+    string stats;
+    if (activeDoc->isEncrypted) stats = "Words: -  Characters: -  (encrypted)";
+    else {
+        stats = "Words: " + to_string(getWordTotal()) + "  Characters: " + to_string(getCharacterTotal()) +
+            "  Headings: " + to_string(getHeadingTotal()) + "  Pages: " + to_string(getPageCount());
+    }
+    gotoxy(col1_start_X, STATS_BAR_Y);
+    cout << stats << string(max(0, page_end_X - col1_start_X - (int)stats.length()), ' ');
+}
+
 void updateMainStatus(string message) {
+    drawDocumentStats();
     clearStatusBar();
     gotoxy(col1_start_X, STATUS_BAR_Y);
     cout << message;
 
     string alignName = getAlignmentName();
-    string encName = isEncrypted ? "ENCRYPTED" : "PLAIN";
+    string encName = activeDoc->isEncrypted ? "ENCRYPTED" : "PLAIN";
     string status = "[" + alignName + "] [" + encName + "]";
 
     gotoxy(page_end_X - status.length(), STATUS_BAR_Y);
@@ -202,28 +1108,34 @@ void clearLine(int y) {
 /**
  * Bitwise operations for Encryption/Security
  */
-unsigned char RotL(unsigned char b, int n) {
-    n = n & 7; return (b << n) | (b >> (8 - n));
+constexpr unsigned char RotL(unsigned char b, int n) {
+    n = n & 7; return (unsigned char)((b << n) | (b >> (8 - n)));
 }
 
-unsigned char RotR(unsigned char b, int n) {
-    n = n & 7; return (b >> n) | (b << (8 - n));
+constexpr unsigned char RotR(unsigned char b, int n) {
+    n = n & 7; return (unsigned char)((b >> n) | (b << (8 - n)));
+}
+
+// pos mod length with shifts and subtraction only, in O(log) steps
+int reduceKeyIndex(int pos, int length) {
+    int step = length;
+    while (step <= (pos >> 1)) step <<= 1;
+    for (; step >= length; step >>= 1) {
+        if (pos >= step) pos -= step;
+    }
+    return pos;
 }
 
 unsigned char getDynamicKey(const string& baseKey, int docLength, int pos) {
     unsigned char key = 'k';
-    if (baseKey.length() > 0) {
-        int keyIndex = pos;
-        while (keyIndex >= baseKey.length()) keyIndex -= baseKey.length();
-        key = baseKey[keyIndex];
-    }
+    if (baseKey.length() > 0) key = baseKey[reduceKeyIndex(pos, (int)baseKey.length())];
     key ^= (pos & 0xFF);
     key = RotL(key, (docLength & 3));
     key ^= ((pos >> 8) & 0xFF);
     return key;
 }
 
-unsigned char shuffleBits(unsigned char b) {
+constexpr unsigned char shuffleBits(unsigned char b) {
     unsigned char b0_7 = (b & 0x81), b1_6 = (b & 0x42), b_mid = (b & 0x3C);
     unsigned char swapped_b0_7 = ((b0_7 & 0x80) >> 7) | ((b0_7 & 0x01) << 7);
     unsigned char swapped_b1_6 = ((b1_6 & 0x40) >> 5) | ((b1_6 & 0x02) << 5);
@@ -232,7 +1144,7 @@ unsigned char shuffleBits(unsigned char b) {
     return swapped_b0_7 | swapped_b1_6 | b_mid;
 }
 
-unsigned char unshuffleBits(unsigned char b) {
+constexpr unsigned char unshuffleBits(unsigned char b) {
     unsigned char b0_7 = (b & 0x81), b1_6 = (b & 0x42), b_mid = (b & 0x3C);
     unsigned char swapped_b0_7 = ((b0_7 & 0x80) >> 7) | ((b0_7 & 0x01) << 7);
     unsigned char swapped_b1_6 = ((b1_6 & 0x40) >> 5) | ((b1_6 & 0x02) << 5);
@@ -241,244 +1153,1312 @@ unsigned char unshuffleBits(unsigned char b) {
     return swapped_b0_7 | swapped_b1_6 | b_mid;
 }
 
-unsigned char calculateChecksum(const string& data) {
-    unsigned char sum = 0; int len = data.length();
-    for (int i = 0; i < len; ++i) sum ^= data[i];
+/**
+ * Cipher Lookup Tables
+ * The per-byte permutations are evaluated once at compile time, so the cipher
+ * loop does a lookup instead of a dozen mask and shift operations.
+ */
+struct ByteTable {
+    unsigned char values[256];
+    constexpr unsigned char operator[](unsigned char b) const { return values[b]; }
+};
+
+enum ByteTableKind { TABLE_SHUFFLE, TABLE_UNSHUFFLE, TABLE_CHAIN };
+
+constexpr ByteTable buildByteTable(ByteTableKind kind) {
+    ByteTable table = {};
+    for (int b = 0; b < 256; ++b) {
+        unsigned char c = (unsigned char)b;
+        if (kind == TABLE_SHUFFLE) table.values[b] = shuffleBits(c);
+        else if (kind == TABLE_UNSHUFFLE) table.values[b] = unshuffleBits(c);
+        else table.values[b] = RotL(c, 3); // Block chaining mixes in the previous byte rotated by 3
+    }
+    return table;
+}
+
+constexpr ByteTable shuffle_table = buildByteTable(TABLE_SHUFFLE);
+constexpr ByteTable unshuffle_table = buildByteTable(TABLE_UNSHUFFLE);
+constexpr ByteTable chain_table = buildByteTable(TABLE_CHAIN);
+static_assert(unshuffle_table[shuffle_table[0xA5]] == 0xA5 && unshuffle_table[shuffle_table[0x24]] == 0x24,
+    "unshuffle must invert shuffle");
+
+/**
+ * Key Schedule
+ * getDynamicKey() for a run of positions. The key index advances with a wrap
+ * instead of being reduced per byte, and the rotation by the document length
+ * is applied to the key bytes and position bytes up front.
+ */
+const int keystream_block_size = 4096; // Keystream bytes generated per pass of the cipher loop
+
+struct KeySchedule {
+    string rotatedKey;                  // Key bytes (or the 'k' default), rotated by the document length
+    unsigned char rotatedPosition[256]; // RotL(pos & 0xFF, docLength & 3)
+};
+
+void buildKeySchedule(KeySchedule& schedule, const string& baseKey, int docLength) {
+    int rotation = docLength & 3;
+    schedule.rotatedKey = baseKey.empty() ? string(1, 'k') : baseKey;
+    for (size_t i = 0; i < schedule.rotatedKey.length(); ++i) schedule.rotatedKey[i] = RotL(schedule.rotatedKey[i], rotation);
+    for (int b = 0; b < 256; ++b) schedule.rotatedPosition[b] = RotL((unsigned char)b, rotation);
+}
+
+// Writes getDynamicKey(baseKey, docLength, begin + j) for j in [0, count)
+void fillKeystream(unsigned char* keystream, const KeySchedule& schedule, int begin, int count) {
+    const unsigned char* key = (const unsigned char*)schedule.rotatedKey.data();
+    int keyLength = schedule.rotatedKey.length();
+    int keyIndex = reduceKeyIndex(begin, keyLength);
+    for (int j = 0; j < count; ++j) {
+        int pos = begin + j;
+        keystream[j] = key[keyIndex] ^ schedule.rotatedPosition[pos & 0xFF] ^ (unsigned char)((pos >> 8) & 0xFF);
+        if (++keyIndex == keyLength) keyIndex = 0;
+    }
+}
+
+/**
+ * Byte Scans
+ * Whole-buffer passes used when classifying and verifying files. With SSE2
+ * (every x64 target) they run 16 bytes per step; otherwise 8 bytes per step
+ * in a 64-bit word. Define DOCEDITOR_NO_SIMD to force the word version.
+ */
+#if !defined(DOCEDITOR_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define DOCEDITOR_SSE2 1
+#include <emmintrin.h>
+#endif
+#if !defined(DOCEDITOR_NO_SIMD) && defined(__SSE4_2__) && defined(__x86_64__)
+#define DOCEDITOR_SSE42_CRC 1
+#include <nmmintrin.h>
+#endif
+
+const unsigned long long low_bit_mask = 0x0101010101010101ULL;
+
+// Number of bytes whose lowest bit is set
+size_t countLowBits(const char* data, size_t length) {
+    size_t count = 0, i = 0;
+#ifdef DOCEDITOR_SSE2
+    const __m128i lowBits = _mm_set1_epi8(1), zero = _mm_setzero_si128();
+    __m128i sums = zero; // Two 64-bit running totals
+    for (; i + 16 <= length; i += 16) {
+        __m128i bits = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i)), lowBits);
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(bits, zero));
+    }
+    unsigned long long lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, sums);
+    count = (size_t)(lanes[0] + lanes[1]);
+#endif
+    for (; i + 8 <= length; i += 8) {
+        unsigned long long word;
+        memcpy(&word, data + i, 8);
+        count += (size_t)(((word & low_bit_mask) * low_bit_mask) >> 56); // Popcount of at most 8 set bits
+    }
+    for (; i < length; ++i) count += data[i] & 1;
+    return count;
+}
+
+// XOR of every byte
+unsigned char xorBytes(const char* data, size_t length) {
+    unsigned long long folded = 0;
+    size_t i = 0;
+#ifdef DOCEDITOR_SSE2
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) acc = _mm_xor_si128(acc, _mm_loadu_si128((const __m128i*)(data + i)));
+    unsigned long long lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    folded = lanes[0] ^ lanes[1];
+#endif
+    for (; i + 8 <= length; i += 8) {
+        unsigned long long word;
+        memcpy(&word, data + i, 8);
+        folded ^= word;
+    }
+    folded ^= folded >> 32; folded ^= folded >> 16; folded ^= folded >> 8;
+    unsigned char sum = (unsigned char)folded;
+    for (; i < length; ++i) sum ^= data[i];
+    return sum;
+}
+
+// Final mixing step, split out so a streamed XOR of the bytes can be finished too
+unsigned char finishChecksum(unsigned char sum, long long len) {
     sum = RotL(sum, (len & 7)); sum ^= CHECKSUM_MAGIC;
     return sum;
 }
 
-bool isLikelyEncrypted(const string& data) {
+unsigned char calculateChecksum(string_view data) {
+    return finishChecksum(xorBytes(data.data(), data.length()), data.length());
+}
+
+/**
+ * Page Content Hashes
+ * Each page keeps a 64-bit hash of its text and line layout, refreshed by
+ * indexPage(), so comparing two documents only reads the pages whose hashes
+ * differ. The hash mixes 8 bytes per step; hashText() stays FNV-1a because
+ * saved key fingerprints depend on it.
+ */
+unsigned long long mixHash(unsigned long long value) {
+    value ^= value >> 32;
+    value *= 0xD6E8FEB86659FD93ULL;
+    value ^= value >> 32;
+    return value;
+}
+
+unsigned long long hashBytes(const char* data, size_t length, unsigned long long seed) {
+    const unsigned long long multiplier = 0x9E3779B97F4A7C15ULL;
+    unsigned long long hash = seed ^ (length * multiplier);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        unsigned long long word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ mixHash(word)) * multiplier;
+    }
+    if (i < length) {
+        unsigned long long tail = 0;
+        memcpy(&tail, data + i, length - i);
+        hash = (hash ^ mixHash(tail)) * multiplier;
+    }
+    return mixHash(hash);
+}
+
+// Equal slabs hash equal; an empty slab (what a new page holds) hashes to 0
+unsigned long long hashPageSlab(const PageSlab* slab) {
+    if (slab->text.empty()) return 0;
+    unsigned long long hash = hashBytes(slab->text.data(), slab->text.length(), 0);
+    return hashBytes((const char*)slab->lineEnd, sizeof(slab->lineEnd), hash);
+}
+
+/**
+ * Page Statistics
+ * Words are runs of non-blank bytes. Characters are non-blank characters:
+ * UTF-8 continuation bytes and the spaces alignment pads lines with are not
+ * counted, and neither are a heading's leading '#' marks. A page is counted
+ * as one flat scan of its slab, then corrected at line boundaries.
+ */
+bool isBlankByte(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Adds the words and characters of a byte range (a word may run in from data[-1])
+void countTextStats(const char* data, size_t length, bool afterWord, PageStats& stats) {
+    size_t i = 0;
+#ifdef DOCEDITOR_SSE2
+    const __m128i spaces = _mm_set1_epi8(' '), tabs = _mm_set1_epi8('\t'), leads = _mm_set1_epi8((char)0xC0);
+    const __m128i lowBits = _mm_set1_epi8(1), zero = _mm_setzero_si128(), ones = _mm_set1_epi8(-1);
+    __m128i wordSums = zero, characterSums = zero;
+    __m128i previous = afterWord ? ones : zero; // Only its top byte is used
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i nonBlank = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, spaces), _mm_cmpeq_epi8(bytes, tabs)), ones);
+        __m128i before = _mm_or_si128(_mm_slli_si128(nonBlank, 1), _mm_srli_si128(previous, 15));
+        __m128i starts = _mm_andnot_si128(before, nonBlank);
+        __m128i counted = _mm_andnot_si128(_mm_cmplt_epi8(bytes, leads), nonBlank); // 0x80-0xBF continue a character
+        wordSums = _mm_add_epi64(wordSums, _mm_sad_epu8(_mm_and_si128(starts, lowBits), zero));
+        characterSums = _mm_add_epi64(characterSums, _mm_sad_epu8(_mm_and_si128(counted, lowBits), zero));
+        previous = nonBlank;
+    }
+    unsigned long long lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, wordSums);
+    stats.words += (int)(lanes[0] + lanes[1]);
+    _mm_storeu_si128((__m128i*)lanes, characterSums);
+    stats.characters += (int)(lanes[0] + lanes[1]);
+    if (i > 0) afterWord = !isBlankByte(data[i - 1]);
+#endif
+    for (; i < length; ++i) {
+        bool nonBlank = !isBlankByte(data[i]);
+        stats.words += nonBlank && !afterWord;
+        stats.characters += nonBlank && ((unsigned char)data[i] & 0xC0) != 0x80;
+        afterWord = nonBlank;
+    }
+}
+
+PageStats countSlabStats(const PageSlab* slab) {
+    PageStats stats = PageStats();
+    const char* text = slab->text.data();
+    countTextStats(text, slab->text.length(), false, stats);
+    for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) {
+        int start = slab->lineStart(l), length = slab->lineLength(l);
+        if (length == 0) continue;
+        // The flat scan joined this line's first word to the previous line's last one
+        if (start > 0 && !isBlankByte(text[start - 1]) && !isBlankByte(text[start])) stats.words++;
+        int level = 0;
+        while (level < length && text[start + level] == '#') level++;
+        stats.characters -= level;
+        if (level > 0 && (level == length || isBlankByte(text[start + level]))) stats.words--;
+    }
+    return stats;
+}
+
+void indexPageStats(DocumentPage* page) {
+    if (page == nullptr) return;
+    PageStats stats = countSlabStats(page->slab);
+    if (page->pageIndex < activeDoc->wordCounts.size()) {
+        if (stats.words != page->stats.words) activeDoc->wordCounts.add(page->pageIndex, stats.words - page->stats.words);
+        if (stats.characters != page->stats.characters) {
+            activeDoc->characterCounts.add(page->pageIndex, stats.characters - page->stats.characters);
+        }
+    }
+    page->stats = stats;
+}
+
+// Refreshes a page's entry in the page index after its content was replaced
+void indexPage(DocumentPage* page) {
+    indexPageHeadings(page);
+    indexPageStats(page);
+    if (page != nullptr) page->contentHash = hashPageSlab(page->slab);
+}
+
+/**
+ * Encryption detection for files without a format header. Cipher text has
+ * about as many odd bytes as even ones. A prefix sample is checked first:
+ * a ratio clearly outside the cipher range rejects the file without a full
+ * scan, and only files that still look like cipher text are counted in full.
+ */
+const size_t encryption_sample_size = 64 * 1024;
+
+bool isOddByteRatioInRange(const char* data, size_t length, double low, double high) {
+    double onesRatio = (double)countLowBits(data, length) / length;
+    return (onesRatio >= low && onesRatio <= high);
+}
+
+bool isLikelyEncrypted(string_view data) {
     if (data.length() < 32) return false;
-    long long onesCount = 0;
-    long long dataLen = data.length();
+    if (data.length() > encryption_sample_size * 2 &&
+        !isOddByteRatioInRange(data.data(), encryption_sample_size, 0.40, 0.60)) return false;
+    return isOddByteRatioInRange(data.data(), data.length(), 0.45, 0.55);
+}
+
+/**
+ * CRC32C (Castagnoli) for encrypted file trailers. It catches every burst
+ * error up to 32 bits and all single-byte changes, where the XOR checksum
+ * misses any pair of changes that cancel. The tables are built at compile
+ * time and consumed 8 bytes per step (slicing-by-8, little-endian words);
+ * builds with SSE4.2 enabled use the crc32 instruction instead.
+ */
+struct Crc32cTables {
+    uint32_t values[8][256];
+};
 
-    for (int i = 0; i < dataLen; ++i) {
-        if ((data[i] & 1) != 0) {
-            onesCount++;
+constexpr Crc32cTables buildCrc32cTables() {
+    Crc32cTables tables = {};
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+        tables.values[0][b] = crc;
+    }
+    for (int slice = 1; slice < 8; ++slice) {
+        for (int b = 0; b < 256; ++b) {
+            uint32_t crc = tables.values[slice - 1][b];
+            tables.values[slice][b] = (crc >> 8) ^ tables.values[0][crc & 0xFF];
         }
     }
-    double onesRatio = (double)onesCount / dataLen;
-    return (onesRatio >= 0.45 && onesRatio <= 0.55);
+    return tables;
+}
+
+constexpr Crc32cTables crc32c_tables = buildCrc32cTables();
+
+// CRC32C of data; pass a previous result as crc to continue across pieces
+uint32_t crc32c(string_view data, uint32_t crc = 0) {
+    const unsigned char* bytes = (const unsigned char*)data.data();
+    size_t length = data.length(), i = 0;
+    crc = ~crc;
+#ifdef DOCEDITOR_SSE42_CRC
+    unsigned long long wide = crc;
+    for (; i + 8 <= length; i += 8) {
+        unsigned long long word;
+        memcpy(&word, bytes + i, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = (uint32_t)wide;
+#else
+    const uint32_t (*t)[256] = crc32c_tables.values;
+    for (; i + 8 <= length; i += 8) {
+        uint32_t low, high;
+        memcpy(&low, bytes + i, 4);
+        memcpy(&high, bytes + i + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+              t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+    }
+#endif
+    for (; i < length; ++i) crc = (crc >> 8) ^ crc32c_tables.values[0][(crc ^ bytes[i]) & 0xFF];
+    return ~crc;
 }
 
 /**
  * Encryption and Decryption Engines
  */
-string encrypt(string data, const string& baseKey) {
-    int len = data.length(); if (len == 0) return "";
+// Ciphers bytes [begin, end) in place. Chaining restarts every 8 bytes, so
+// ranges that start on a multiple of 8 can be processed independently.
+void encryptRange(string& data, const string& baseKey, int begin, int end) {
+    PERF_SCOPE(PERF_ENCRYPT, end - begin);
+    int len = data.length();
+    KeySchedule schedule;
+    buildKeySchedule(schedule, baseKey, len);
+    unsigned char keystream[keystream_block_size];
+    unsigned char* bytes = (unsigned char*)&data[0];
+    unsigned char prev_cipher = 0;
+    for (int blockStart = begin; blockStart < end; blockStart += keystream_block_size) {
+        int count = min(keystream_block_size, end - blockStart);
+        fillKeystream(keystream, schedule, blockStart, count);
+        for (int j = 0; j < count; ++j) {
+            int i = blockStart + j;
+            if ((i & 7) == 0) prev_cipher = 0;
+            unsigned char b = shuffle_table[bytes[i]] ^ keystream[j] ^ chain_table[prev_cipher];
+            prev_cipher = b; bytes[i] = b;
+        }
+    }
+}
+
+void decryptRange(string& data, const string& baseKey, int begin, int end) {
+    PERF_SCOPE(PERF_DECRYPT, end - begin);
+    int len = data.length();
+    KeySchedule schedule;
+    buildKeySchedule(schedule, baseKey, len);
+    unsigned char keystream[keystream_block_size];
+    unsigned char* bytes = (unsigned char*)&data[0];
     unsigned char prev_cipher = 0;
-    for (int i = 0; i < len; ++i) {
-        unsigned char b = data[i];
-        b = shuffleBits(b); b ^= getDynamicKey(baseKey, len, i);
-        if ((i & 7) == 0) prev_cipher = 0;
-        b ^= RotL(prev_cipher, 3);
-        prev_cipher = b; data[i] = b;
+    for (int blockStart = begin; blockStart < end; blockStart += keystream_block_size) {
+        int count = min(keystream_block_size, end - blockStart);
+        fillKeystream(keystream, schedule, blockStart, count);
+        for (int j = 0; j < count; ++j) {
+            int i = blockStart + j;
+            if ((i & 7) == 0) prev_cipher = 0;
+            unsigned char current_cipher = bytes[i];
+            bytes[i] = unshuffle_table[(unsigned char)(current_cipher ^ chain_table[prev_cipher] ^ keystream[j])];
+            prev_cipher = current_cipher;
+        }
     }
+}
+
+string encrypt(string data, const string& baseKey) {
+    int len = data.length(); if (len == 0) return "";
+    encryptRange(data, baseKey, 0, len);
     return data;
 }
 
 string decrypt(string data, const string& baseKey) {
     int len = data.length(); if (len == 0) return "";
-    unsigned char prev_cipher = 0;
-    for (int i = 0; i < len; ++i) {
-        unsigned char current_cipher = data[i];
-        if ((i & 7) == 0) prev_cipher = 0;
-        unsigned char b = current_cipher ^ RotL(prev_cipher, 3);
-        b ^= getDynamicKey(baseKey, len, i); b = unshuffleBits(b);
-        data[i] = b; prev_cipher = current_cipher;
-    }
+    decryptRange(data, baseKey, 0, len);
     return data;
 }
 
 /**
- * General User Input Handlers
+ * Encrypted Document Format
+ * The cipher runs over a payload of an 8-byte key fingerprint followed by the
+ * serialized document, so a wrong key is detected after decrypting instead
+ * of being installed as garbage. Files add a magic in front and a checksum
+ * of the cipher text at the end: encrypted_file_magic files end in a 4-byte
+ * CRC32C, encrypted_file_magic_xor files (the first headered version) in
+ * the one-byte XOR checksum. Files without a magic are legacy files and are
+ * still recognised by isLikelyEncrypted().
  */
-string getSimpleTextInput(int promptOffset) {
-    string input = ""; char c; int y = STATUS_BAR_Y;
-    gotoxy(promptOffset, y);
-    showCursor();
-    while (true) {
-        c = _getch();
-        if (c == 13) break;
-        if (c == 8) {
-            if (!input.empty()) {
-                input = input.substr(0, input.length() - 1);
-                gotoxy(promptOffset + input.length(), y);
-                cout << " "; gotoxy(promptOffset + input.length(), y);
-            }
-        }
-        else { input += c; cout << c; }
+enum FileChecksum { CHECKSUM_CRC32C, CHECKSUM_XOR8 };
+
+const string encrypted_file_magic = string(1, ESCAPE_BYTE) + "ENC3";
+const string encrypted_file_magic_xor = string(1, ESCAPE_BYTE) + "ENC2";
+const int key_fingerprint_length = 8; // Keeps the document 8-byte aligned in the cipher
+
+unsigned long long hashText(string_view text) {
+    unsigned long long hash = 1469598103934665603ULL; // FNV-1a
+    for (size_t i = 0; i < text.length(); ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
     }
-    hideCursor();
-    return input;
+    return hash;
+}
+
+string getKeyFingerprint(const string& key) {
+    unsigned long long hash = hashText(key);
+    string fingerprint(key_fingerprint_length, '\0');
+    for (int i = 0; i < key_fingerprint_length; ++i) fingerprint[i] = (char)(hash >> (i * 8));
+    return fingerprint;
+}
+
+bool startsWith(string_view data, const string& prefix) {
+    return data.substr(0, prefix.length()) == prefix;
+}
+
+// True when a decrypted payload was made with this key
+bool matchesKeyFingerprint(string_view payload, const string& key) {
+    return startsWith(payload, getKeyFingerprint(key));
+}
+
+int getChecksumLength(FileChecksum checksum) {
+    return (checksum == CHECKSUM_CRC32C) ? 4 : 1;
+}
+
+string getFileMagic(FileChecksum checksum) {
+    return (checksum == CHECKSUM_CRC32C) ? encrypted_file_magic : encrypted_file_magic_xor;
+}
+
+// Checksum trailer for cipher text; CRC32C is stored little-endian
+string calculateFileChecksum(string_view cipher, FileChecksum checksum) {
+    if (checksum == CHECKSUM_XOR8) return string(1, (char)calculateChecksum(cipher));
+    uint32_t crc = crc32c(cipher);
+    string trailer(4, '\0');
+    for (int i = 0; i < 4; ++i) trailer[i] = (char)(crc >> (i * 8));
+    return trailer;
+}
+
+// Which checksum an encrypted file uses; false when data is not one
+bool getFileChecksum(string_view data, FileChecksum& checksum) {
+    if (startsWith(data, encrypted_file_magic)) checksum = CHECKSUM_CRC32C;
+    else if (startsWith(data, encrypted_file_magic_xor)) checksum = CHECKSUM_XOR8;
+    else return false;
+    return data.length() > getFileMagic(checksum).length() + getChecksumLength(checksum);
+}
+
+bool isEncryptedFile(string_view data) {
+    FileChecksum checksum;
+    return getFileChecksum(data, checksum);
+}
+
+// Files saved before the format header: cipher-like bytes ending in the XOR
+// checksum of the rest. Plain text can pass the byte-ratio test alone.
+bool isLegacyEncryptedFile(string_view data) {
+    if (!isLikelyEncrypted(data)) return false;
+    return calculateChecksum(data.substr(0, data.length() - 1)) == (unsigned char)data.back();
+}
+
+// Wraps cipher text as written to disk: magic, cipher, checksum trailer
+string buildEncryptedFile(const string& cipher, FileChecksum checksum = CHECKSUM_CRC32C) {
+    string magic = getFileMagic(checksum);
+    string file;
+    file.reserve(magic.length() + cipher.length() + getChecksumLength(checksum));
+    file += magic;
+    file += cipher;
+    file += calculateFileChecksum(cipher, checksum);
+    return file;
+}
+
+// The cipher text inside an encrypted file; false when the checksum does not match
+bool extractFileCipher(const string& file, string& cipher) {
+    FileChecksum checksum;
+    if (!getFileChecksum(file, checksum)) return false;
+    size_t bodyStart = getFileMagic(checksum).length();
+    size_t trailerStart = file.length() - getChecksumLength(checksum);
+    string_view body = string_view(file).substr(bodyStart, trailerStart - bodyStart);
+    if (calculateFileChecksum(body, checksum) != string_view(file).substr(trailerStart)) return false;
+    cipher.assign(body.data(), body.length());
+    return true;
 }
 
 /**
- * Serialization Functions
- * Converts between memory objects and string formats for persistence.
+ * Background Task Scheduler
+ * Long operations (save, load, encrypt/decrypt, document search, export) run on the
+ * worker pool below so the input loop keeps rendering and navigating.
+ *
+ * Concurrency discipline: workers never touch the page list, the pools or the
+ * console. They read slab snapshots taken on the UI thread (a snapshot holds a
+ * reference, so edits copy-on-write around it) and hand their results to
+ * complete(), which pollBackgroundTasks() runs back on the UI thread with the
+ * task's own document active. Results that would replace the document compare
+ * documentVersion first and are dropped if the document changed while they ran.
  */
-string serializePage(DocumentPage* pagePtr) {
-    if (pagePtr == nullptr) return "";
-    string snapshot = "";
-    for (int i = 0; i < MAX_LINES_PER_PAGE_STORAGE; ++i) {
-        snapshot += pagePtr->content[i];
-        if (i < (MAX_LINES_PER_PAGE_STORAGE)-1) snapshot += DELIMITER;
+enum BackgroundTaskKind { TASK_SAVE, TASK_LOAD, TASK_CIPHER, TASK_SEARCH, TASK_EXPORT };
+
+struct BackgroundTask {
+    BackgroundTaskKind kind;
+    string label;
+    Document* document; // complete() runs with this document active
+    int startVersion;
+    atomic<const char*> phase;
+    atomic<int> percent;
+    atomic<bool> cancelRequested;
+    atomic<bool> finished;
+
+    vector<PageSlab*> snapshot; // Released on the UI thread after complete()
+    string data;                // Payload produced or consumed by work()
+    bool succeeded;
+    string message;             // Shown in the status bar once complete() returns
+    bool replacesDocument;      // Set by complete() when the page view must be redrawn
+
+    function<void(BackgroundTask&)> work;     // Worker thread
+    function<void(BackgroundTask&)> complete; // UI thread, also runs after a cancel
+
+    BackgroundTask(BackgroundTaskKind taskKind, string taskLabel)
+        : kind(taskKind), label(taskLabel), document(activeDoc), startVersion(activeDoc->documentVersion), phase(""), percent(0),
+        cancelRequested(false), finished(false), succeeded(false), replacesDocument(false) {}
+
+    bool isCancelled() const { return cancelRequested.load(); }
+
+    void report(const char* phaseName, long long done, long long total) {
+        phase.store(phaseName);
+        percent.store(total > 0 ? (int)(done * 100 / total) : 100);
     }
-    return snapshot;
+};
+
+vector<BackgroundTask*> activeTasks; // UI thread only
+const int background_chunk_size = 1 << 20; // Multiple of 8 (cipher block)
+
+/**
+ * Work-Stealing Worker Pool
+ * Each worker owns a deque: it pushes and pops its own jobs at the back and,
+ * once it runs dry, steals from the front of the other workers' deques. Jobs
+ * posted from outside the pool are dealt round-robin. A thread that waits on
+ * jobs it posted helps run them (runWorkerJobsUntil), so a job may fan out
+ * into sub-jobs without deadlocking the pool.
+ */
+struct WorkerQueue {
+    mutex lock;
+    deque<function<void()>> jobs;
+};
+
+vector<thread> workerThreads;
+vector<WorkerQueue*> workerQueues;
+mutex workerSleepLock;
+condition_variable workerWake;
+condition_variable workerJobDone; // Wakes threads blocked in runWorkerJobsUntil
+atomic<int> pendingWorkerJobs(0);
+atomic<unsigned> nextInjectQueue(0);
+bool workersStopping = false; // Guarded by workerSleepLock
+thread_local int currentWorkerId = -1;
+
+// Takes a job from the home deque (back) or steals one from another deque (front)
+bool popWorkerJob(int home, function<void()>& job) {
+    int count = workerQueues.size();
+    if (home >= 0) {
+        WorkerQueue* own = workerQueues[home];
+        lock_guard<mutex> guard(own->lock);
+        if (!own->jobs.empty()) {
+            job = move(own->jobs.back());
+            own->jobs.pop_back();
+            pendingWorkerJobs--;
+            return true;
+        }
+    }
+    int start = (home >= 0) ? home + 1 : 0;
+    for (int i = 0; i < count; ++i) {
+        WorkerQueue* victim = workerQueues[(start + i) % count];
+        lock_guard<mutex> guard(victim->lock);
+        if (!victim->jobs.empty()) {
+            job = move(victim->jobs.front());
+            victim->jobs.pop_front();
+            pendingWorkerJobs--;
+            return true;
+        }
+    }
+    return false;
 }
 
-void deserializePage(DocumentPage* pagePtr, string data) {
-    if (pagePtr == nullptr) return;
-    for (int i = 0; i < MAX_LINES_PER_PAGE_STORAGE; ++i) pagePtr->content[i] = "";
-    int lineIndex = 0, startPos = 0;
-    for (int i = 0; i < data.length(); ++i) {
-        if (data[i] == DELIMITER) {
-            if (lineIndex < MAX_LINES_PER_PAGE_STORAGE) pagePtr->content[lineIndex] = data.substr(startPos, i - startPos);
-            lineIndex++; startPos = i + 1;
+// Runs a job, then wakes any thread waiting for the pool to make progress
+void runWorkerJob(function<void()>& job) {
+    job();
+    {
+        lock_guard<mutex> guard(workerSleepLock);
+    }
+    workerJobDone.notify_all();
+}
+
+void workerLoop(int id) {
+    currentWorkerId = id;
+    while (true) {
+        function<void()> job;
+        if (popWorkerJob(id, job)) {
+            runWorkerJob(job);
+            continue;
         }
+        unique_lock<mutex> guard(workerSleepLock);
+        workerWake.wait(guard, [] { return workersStopping || pendingWorkerJobs.load() > 0; });
+        if (workersStopping && pendingWorkerJobs.load() == 0) return; // Stopping and drained
     }
-    if (startPos < data.length() && lineIndex < MAX_LINES_PER_PAGE_STORAGE) pagePtr->content[lineIndex] = data.substr(startPos);
 }
 
-string serializeDocument() {
-    string fullDocument = "";
-    DocumentPage* current = headPage;
-    while (current != nullptr) {
-        fullDocument += serializePage(current);
-        if (current->next != nullptr) fullDocument += PAGE_DELIMITER;
-        current = current->next;
+int getWorkerCount() {
+    int cores = (int)thread::hardware_concurrency();
+    return (cores > 2) ? cores - 1 : 1; // Leave a core for the input loop
+}
+
+void stopWorkerPool() {
+    {
+        lock_guard<mutex> guard(workerSleepLock);
+        workersStopping = true;
     }
-    return fullDocument;
+    workerWake.notify_all();
+    for (int i = 0; i < (int)workerThreads.size(); ++i) workerThreads[i].join();
+    workerThreads.clear();
+    for (int i = 0; i < (int)workerQueues.size(); ++i) delete workerQueues[i];
+    workerQueues.clear();
+    workersStopping = false;
 }
 
-void deserializeDocument(string data) {
-    DocumentPage* current = headPage;
-    while (current != nullptr) {
-        DocumentPage* next = current->next;
-        delete current;
-        current = next;
+// Starts (or restarts) the pool with an explicit number of workers
+void startWorkerPool(int count) {
+    if (!workerThreads.empty()) stopWorkerPool();
+    if (count < 1) count = 1;
+    for (int i = 0; i < count; ++i) workerQueues.push_back(new WorkerQueue());
+    for (int i = 0; i < count; ++i) workerThreads.emplace_back(workerLoop, i);
+}
+
+// The pool starts on first use, so tools that never post work never spawn threads
+void postWorkerJob(function<void()> job) {
+    if (workerThreads.empty()) startWorkerPool(getWorkerCount());
+    int target = (currentWorkerId >= 0) ? currentWorkerId : (int)(nextInjectQueue++ % workerQueues.size());
+    {
+        lock_guard<mutex> guard(workerQueues[target]->lock);
+        workerQueues[target]->jobs.push_back(move(job));
+        pendingWorkerJobs++;
     }
-    headPage = nullptr;
-    currentPagePtr = nullptr;
-    nextPageGlobalIndex = 0;
+    {
+        lock_guard<mutex> guard(workerSleepLock);
+    }
+    workerWake.notify_one();
+    workerJobDone.notify_one();
+}
 
-    int startPos = 0;
-    for (int i = 0; i < data.length(); ++i) {
-        if (data[i] == PAGE_DELIMITER) {
-            DocumentPage* newPage = addNewPage();
-            deserializePage(newPage, data.substr(startPos, i - startPos));
-            startPos = i + 1;
+// Runs queued jobs on the calling thread until done() holds; sleeps while
+// every remaining job is already running elsewhere. done() must only change
+// inside a job, since a finished job is what wakes the caller.
+void runWorkerJobsUntil(const function<bool()>& done) {
+    while (!done()) {
+        function<void()> job;
+        if (popWorkerJob(currentWorkerId, job)) {
+            runWorkerJob(job);
+            continue;
         }
+        unique_lock<mutex> guard(workerSleepLock);
+        workerJobDone.wait(guard, [&] { return done() || pendingWorkerJobs.load() > 0; });
     }
-    DocumentPage* lastPage = addNewPage();
-    deserializePage(lastPage, data.substr(startPos));
-    currentPagePtr = headPage;
 }
 
-/**
- * Undo and Redo Logic
- */
-void clearRedo(int pageIndex) { redoTop[pageIndex] = -1; }
+void startBackgroundTask(BackgroundTask* task) {
+    activeTasks.push_back(task);
+    postWorkerJob([task] {
+        task->work(*task);
+        task->finished.store(true);
+    });
+}
 
-void pushUndo(int pageIndex) {
-    if (pageIndex < 0 || pageIndex >= 100) return;
-    if (undoTop[pageIndex] < history_depth - 1) undoTop[pageIndex]++;
-    else for (int i = 0; i < history_depth - 1; i++) undoStack[pageIndex][i] = undoStack[pageIndex][i + 1];
+bool isTaskKindRunning(BackgroundTaskKind kind) {
+    for (int i = 0; i < (int)activeTasks.size(); ++i) {
+        if (activeTasks[i]->kind == kind) return true;
+    }
+    return false;
+}
 
-    undoStack[pageIndex][undoTop[pageIndex]] = serializePage(currentPagePtr);
-    clearRedo(pageIndex);
+bool hasBackgroundTasks() {
+    return !activeTasks.empty();
 }
 
-void pushRedo(int pageIndex) {
-    if (pageIndex < 0 || pageIndex >= 100) return;
-    if (redoTop[pageIndex] < history_depth - 1) redoTop[pageIndex]++;
-    else for (int i = 0; i < history_depth - 1; i++) redoStack[pageIndex][i] = redoStack[pageIndex][i + 1];
+void cancelBackgroundTasks() {
+    for (int i = 0; i < (int)activeTasks.size(); ++i) activeTasks[i]->cancelRequested.store(true);
+}
 
-    redoStack[pageIndex][redoTop[pageIndex]] = serializePage(currentPagePtr);
+void cancelTaskKind(BackgroundTaskKind kind) {
+    for (int i = 0; i < (int)activeTasks.size(); ++i) {
+        if (activeTasks[i]->kind == kind) activeTasks[i]->cancelRequested.store(true);
+    }
 }
 
-void pushUndoForRedo(int pageIndex) {
-    if (pageIndex < 0 || pageIndex >= 100) return;
-    if (undoTop[pageIndex] < history_depth - 1) undoTop[pageIndex]++;
-    else for (int i = 0; i < history_depth - 1; ++i) undoStack[pageIndex][i] = undoStack[pageIndex][i + 1];
-    undoStack[pageIndex][undoTop[pageIndex]] = serializePage(currentPagePtr);
+/**
+ * Runs completions for finished tasks and shows progress for running ones.
+ * Returns true when a completion replaced the active document; message
+ * receives the last completion's status text.
+ */
+bool pollBackgroundTasks(string& message) {
+    bool replaced = false;
+    for (int i = 0; i < (int)activeTasks.size(); ) {
+        BackgroundTask* task = activeTasks[i];
+        if (!task->finished.load()) { ++i; continue; }
+        activeTasks.erase(activeTasks.begin() + i);
+        {
+            ActiveDocumentScope scope(task->document);
+            task->complete(*task);
+        }
+        for (int s = 0; s < (int)task->snapshot.size(); ++s) releaseSlab(task->snapshot[s]);
+        bool visible = (task->document == activeDoc);
+        if (task->replacesDocument && visible) replaced = true;
+        if (!task->message.empty()) message = visible ? task->message : task->document->name + ": " + task->message;
+        delete task;
+        i = 0; // A completion may start a follow-up task
+    }
+    return replaced;
 }
 
-string popUndo(int pageIndex) {
-    if (pageIndex < 0 || pageIndex >= 100) return "";
-    if (undoTop[pageIndex] == -1) return "";
-    string state = undoStack[pageIndex][undoTop[pageIndex]];
-    undoTop[pageIndex]--; return state;
+string describeBackgroundProgress() {
+    if (activeTasks.empty()) return "";
+    BackgroundTask* task = activeTasks.front();
+    string progress = task->label;
+    const char* phase = task->phase.load();
+    if (phase[0] != '\0') progress += string(" - ") + phase;
+    progress += " " + to_string(task->percent.load()) + "%  [Esc] Cancel";
+    if (activeTasks.size() > 1) progress += " (+" + to_string(activeTasks.size() - 1) + " more)";
+    return progress;
 }
 
-string popRedo(int pageIndex) {
-    if (pageIndex < 0 || pageIndex >= 100) return "";
-    if (redoTop[pageIndex] == -1) return "";
-    string state = redoStack[pageIndex][redoTop[pageIndex]];
-    redoTop[pageIndex]--; return state;
+// Shutdown helper: cancels everything and runs the completions
+void finishBackgroundTasks() {
+    cancelBackgroundTasks();
+    string ignored;
+    while (hasBackgroundTasks()) {
+        pollBackgroundTasks(ignored);
+        if (hasBackgroundTasks()) this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    stopWorkerPool();
+}
+
+// Encrypts or decrypts in place a chunk at a time, reporting progress. False if cancelled.
+bool runCipherInChunks(string& data, const string& key, bool encrypting, BackgroundTask& task) {
+    int len = data.length();
+    for (int begin = 0; begin < len; begin += background_chunk_size) {
+        if (task.isCancelled()) return false;
+        int end = (len - begin > background_chunk_size) ? begin + background_chunk_size : len;
+        if (encrypting) encryptRange(data, key, begin, end);
+        else decryptRange(data, key, begin, end);
+        task.report(encrypting ? "encrypting" : "decrypting", end, len);
+    }
+    return !task.isCancelled();
 }
 
 /**
- * Search and Search History Management
+ * General User Input Handlers
  */
-string toUpper(string s) {
-    string result = "";
-    for (int i = 0; i < s.length(); ++i) {
-        if (s[i] >= 'a' && s[i] <= 'z') result += s[i] - 32;
-        else result += s[i];
+// Parses a positive decimal number typed by the user, -1 if invalid
+int parsePositiveNumber(const string& text) {
+    if (text.empty() || text.length() > 9) return -1;
+    int value = 0;
+    for (size_t i = 0; i < text.length(); ++i) {
+        if (text[i] < '0' || text[i] > '9') return -1;
+        value = value * 10 + (text[i] - '0');
     }
-    return result;
+    return (value > 0) ? value : -1;
 }
 
-string getSearchTerm() {
-    updateMainStatusTemp("Search Mode: Type word and press [Enter]. [Backspace] works.");
-    int inputY = STATUS_BAR_Y + 2; gotoxy(0, inputY); cout << "Search: ";
-    string term = ""; char c; showCursor();
+string getSimpleTextInput(int promptOffset) {
+    string input = ""; char c; int y = STATUS_BAR_Y;
+    gotoxy(promptOffset, y);
+    showCursor();
     while (true) {
-        c = _getch();
+        c = readKey();
         if (c == 13) break;
-        else if (c == 8) {
-            if (!term.empty()) {
-                term = term.substr(0, term.length() - 1);
-                gotoxy(8 + term.length(), inputY); cout << " "; gotoxy(8 + term.length(), inputY);
+        if (c == 8) {
+            if (!input.empty()) {
+                input = input.substr(0, input.length() - 1);
+                gotoxy(promptOffset + input.length(), y);
+                cout << " "; gotoxy(promptOffset + input.length(), y);
             }
         }
-        else { term += c; cout << c; }
+        else { input += c; cout << c; }
     }
-    hideCursor(); clearLine(inputY); return term;
+    hideCursor();
+    return input;
 }
 
-int searchAndHighlight(string term) {
-    if (currentPagePtr == nullptr || term.empty()) return 0;
-    int matchCount = 0;
-    string upperTerm = toUpper(term);
+/**
+ * Serialization Functions
+ * Converts between memory objects and string formats for persistence.
+ */
+bool needsEscape(char c) {
+    return c == DELIMITER || c == PAGE_DELIMITER || c == ESCAPE_BYTE;
+}
 
-    for (int i = 0; i < MAX_LINES_PER_PAGE_STORAGE; ++i) {
-        string line = currentPagePtr->content[i];
-        string upperLine = toUpper(line);
-        size_t pos = upperLine.find(upperTerm, 0);
-        while (pos != string::npos) {
-            matchCount++;
-            pos = upperLine.find(upperTerm, pos + upperTerm.length());
-        }
+// Byte size of a slab once serialized (lines plus line delimiters). Escapes
+// are rare, so they are left out and simply grow the output if present.
+size_t getSerializedSlabLength(const PageSlab* slab) {
+    return slab->text.length() + (MAX_LINES_PER_PAGE_STORAGE - 1);
+}
+
+size_t getSerializedPageLength(DocumentPage* pagePtr) {
+    return getSerializedSlabLength(pagePtr->slab);
+}
+
+// Index of the first byte at or after start that needs escaping, or length
+size_t findEscape(const char* text, size_t start, size_t length) {
+    for (size_t i = start; i < length; ++i) {
+        // Every byte that needs escaping is at or below ESCAPE_BYTE
+        if ((unsigned char)text[i] <= (unsigned char)ESCAPE_BYTE && needsEscape(text[i])) return i;
     }
-    return matchCount;
+    return length;
 }
 
-void addSearchToHistory(string term, int matches) {
-    recentSearches[searchHistoryTop] = term; recentCount[searchHistoryTop] = matches;
-    searchHistoryTop = (searchHistoryTop + 1) % search_history_size;
-    if (searchHistoryTotal < search_history_size) searchHistoryTotal++;
+void appendEscaped(string& out, const char* text, size_t length) {
+    size_t runStart = 0;
+    size_t i;
+    while ((i = findEscape(text, runStart, length)) < length) {
+        out.append(text + runStart, i - runStart);
+        out += ESCAPE_BYTE;
+        out += (char)(text[i] ^ escape_flip);
+        runStart = i + 1;
+    }
+    out.append(text + runStart, length - runStart);
 }
 
-void displaySearchHistory() {
-    int historyLineY = STATUS_BAR_Y + 1; clearLine(historyLineY);
-    gotoxy(col1_start_X, historyLineY); cout << "History: ";
-    int startIndex = (searchHistoryTop - 1 + search_history_size) % search_history_size;
-    for (int i = 0; i < searchHistoryTotal; ++i) {
-        int index = (startIndex - i + search_history_size) % search_history_size;
-        cout << recentSearches[index] << "(" << recentCount[index] << ") ";
+// A trailing escape byte with nothing after it is kept as is
+void appendUnescaped(string& out, const char* text, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (text[i] == ESCAPE_BYTE && i + 1 < length) out += (char)(text[++i] ^ escape_flip);
+        else out += text[i];
+    }
+}
+
+void appendSerializedSlab(string& out, const PageSlab* slab) {
+    for (int i = 0; i < MAX_LINES_PER_PAGE_STORAGE; ++i) {
+        appendEscaped(out, slab->text.data() + slab->lineStart(i), slab->lineLength(i));
+        if (i < (MAX_LINES_PER_PAGE_STORAGE)-1) out += DELIMITER;
+    }
+}
+
+void appendSerializedPage(string& out, DocumentPage* pagePtr) {
+    appendSerializedSlab(out, pagePtr->slab);
+}
+
+string serializePage(DocumentPage* pagePtr) {
+    if (pagePtr == nullptr) return "";
+    string snapshot;
+    snapshot.reserve(getSerializedPageLength(pagePtr));
+    appendSerializedPage(snapshot, pagePtr);
+    return snapshot;
+}
+
+// Parses one serialized page into an empty slab: lines are sliced as views
+// and copied once. Lines past the last storage line are ignored.
+void parsePageSlab(PageSlab* slab, string_view data, bool escaped) {
+    slab->text.reserve(data.length());
+    int lineIndex = 0;
+    size_t startPos = 0;
+    while (lineIndex < MAX_LINES_PER_PAGE_STORAGE) {
+        size_t endPos = data.find(DELIMITER, startPos);
+        if (endPos == string_view::npos) endPos = data.length();
+        const char* line = data.data() + startPos;
+        size_t length = endPos - startPos;
+        if (escaped && memchr(line, ESCAPE_BYTE, length) != nullptr) appendUnescaped(slab->text, line, length);
+        else slab->text.append(line, length);
+        slab->lineEnd[lineIndex++] = slab->text.length();
+        if (endPos == data.length()) break;
+        startPos = endPos + 1;
+    }
+    // Lines past the last delimiter stay empty
+    while (lineIndex < MAX_LINES_PER_PAGE_STORAGE) slab->lineEnd[lineIndex++] = slab->text.length();
+}
+
+// Parses one page in place
+void deserializePage(DocumentPage* pagePtr, string_view data, bool escaped = false) {
+    if (pagePtr == nullptr) return;
+    parsePageSlab(pagePtr->rewriteSlab(), data, escaped);
+    indexPage(pagePtr);
+}
+
+string serializeDocument() {
+    // Size the output once so the page appends never reallocate
+    size_t totalLength = document_format_magic.length();
+    for (int i = 0; i < (int)activeDoc->pageTable.size(); ++i) totalLength += getSerializedPageLength(activeDoc->pageTable[i]) + 1;
+    PERF_SCOPE(PERF_SERIALIZE, totalLength);
+
+    string fullDocument;
+    fullDocument.reserve(totalLength);
+    fullDocument += document_format_magic;
+    DocumentPage* current = activeDoc->headPage;
+    while (current != nullptr) {
+        appendSerializedPage(fullDocument, current);
+        if (current->next != nullptr) fullDocument += PAGE_DELIMITER;
+        current = current->next;
+    }
+    return fullDocument;
+}
+
+// Takes an O(pages) snapshot of the whole document (one reference per page slab)
+vector<PageSlab*> snapshotDocument() {
+    vector<PageSlab*> snapshot;
+    snapshot.reserve(activeDoc->pageTable.size());
+    for (int i = 0; i < (int)activeDoc->pageTable.size(); ++i) snapshot.push_back(retainSlab(activeDoc->pageTable[i]->slab));
+    return snapshot;
+}
+
+// Same output as serializeDocument(), after an optional prefix, from a
+// snapshot; safe on a worker thread
+string serializeSnapshot(const vector<PageSlab*>& snapshot, BackgroundTask* task = nullptr, const string& prefix = "") {
+    size_t totalLength = prefix.length() + document_format_magic.length();
+    for (int i = 0; i < (int)snapshot.size(); ++i) totalLength += getSerializedSlabLength(snapshot[i]) + 1;
+
+    string fullDocument;
+    fullDocument.reserve(totalLength);
+    fullDocument += prefix;
+    fullDocument += document_format_magic;
+    for (int i = 0; i < (int)snapshot.size(); ++i) {
+        appendSerializedSlab(fullDocument, snapshot[i]);
+        if (i + 1 < (int)snapshot.size()) fullDocument += PAGE_DELIMITER;
+        if (task != nullptr && (i & 1023) == 0) {
+            if (task->isCancelled()) return "";
+            task->report("serializing", i, snapshot.size());
+        }
+    }
+    return fullDocument;
+}
+
+// Empties the page list so a new document can be appended from page 1
+void resetDocumentPages() {
+    releaseAllPages(); // Pages go back to the pool and are reused below
+    activeDoc->nextPageGlobalIndex = 0;
+    clearPageIndex();
+    markDocumentChanged();
+}
+
+void deserializeDocument(string_view data) {
+    PERF_SCOPE(PERF_DESERIALIZE, data.length());
+    resetDocumentPages();
+    bool escaped = startsWith(data, document_format_magic);
+    if (escaped) data.remove_prefix(document_format_magic.length());
+
+    int pageCount = 1;
+    const char* scan = data.data();
+    const char* end = scan + data.length();
+    while ((scan = (const char*)memchr(scan, PAGE_DELIMITER, end - scan)) != nullptr) {
+        pageCount++;
+        scan++;
+    }
+    reserveDocumentPages(pageCount);
+
+    size_t startPos = 0;
+    while (true) {
+        size_t endPos = data.find(PAGE_DELIMITER, startPos);
+        DocumentPage* newPage = addNewPage();
+        if (endPos == string_view::npos) {
+            deserializePage(newPage, data.substr(startPos), escaped);
+            break;
+        }
+        deserializePage(newPage, data.substr(startPos, endPos - startPos), escaped);
+        startPos = endPos + 1;
+    }
+    activeDoc->currentPagePtr = activeDoc->headPage;
+}
+
+/**
+ * Page Snapshots
+ * A snapshot is a counted reference to a page's current slab: taking one is
+ * O(1), and bytes are only copied if the page is written afterwards.
+ */
+PageSlab* takePageSnapshot(DocumentPage* pagePtr) {
+    if (pagePtr == nullptr) return nullptr;
+    return retainSlab(pagePtr->slab);
+}
+
+// Puts a snapshot back on a page; the page takes over the caller's reference
+void restorePageSnapshot(DocumentPage* pagePtr, PageSlab* snapshot) {
+    if (pagePtr == nullptr || snapshot == nullptr) { releaseSlab(snapshot); return; }
+    releaseSlab(pagePtr->slab);
+    pagePtr->slab = snapshot;
+    indexPage(pagePtr);
+    markDocumentChanged();
+}
+
+/**
+ * Undo and Redo Logic
+ * Slots above the stack top are always empty (nullptr).
+ */
+void clearRedo(int pageIndex) {
+    for (int i = 0; i <= activeDoc->redoTop[pageIndex]; ++i) {
+        releaseSlab(activeDoc->redoStack[pageIndex][i]);
+        activeDoc->redoStack[pageIndex][i] = nullptr;
+    }
+    activeDoc->redoTop[pageIndex] = -1;
+}
+
+void pushUndo(int pageIndex) {
+    if (pageIndex < 0 || pageIndex >= (int)activeDoc->undoTop.size()) return;
+    if (activeDoc->undoTop[pageIndex] < history_depth - 1) activeDoc->undoTop[pageIndex]++;
+    else {
+        releaseSlab(activeDoc->undoStack[pageIndex][0]);
+        for (int i = 0; i < history_depth - 1; i++) activeDoc->undoStack[pageIndex][i] = activeDoc->undoStack[pageIndex][i + 1];
+    }
+
+    activeDoc->undoStack[pageIndex][activeDoc->undoTop[pageIndex]] = takePageSnapshot(activeDoc->currentPagePtr);
+    clearRedo(pageIndex);
+}
+
+void pushRedo(int pageIndex) {
+    if (pageIndex < 0 || pageIndex >= (int)activeDoc->undoTop.size()) return;
+    if (activeDoc->redoTop[pageIndex] < history_depth - 1) activeDoc->redoTop[pageIndex]++;
+    else {
+        releaseSlab(activeDoc->redoStack[pageIndex][0]);
+        for (int i = 0; i < history_depth - 1; i++) activeDoc->redoStack[pageIndex][i] = activeDoc->redoStack[pageIndex][i + 1];
+    }
+
+    activeDoc->redoStack[pageIndex][activeDoc->redoTop[pageIndex]] = takePageSnapshot(activeDoc->currentPagePtr);
+}
+
+void pushUndoForRedo(int pageIndex) {
+    if (pageIndex < 0 || pageIndex >= (int)activeDoc->undoTop.size()) return;
+    if (activeDoc->undoTop[pageIndex] < history_depth - 1) activeDoc->undoTop[pageIndex]++;
+    else {
+        releaseSlab(activeDoc->undoStack[pageIndex][0]);
+        for (int i = 0; i < history_depth - 1; ++i) activeDoc->undoStack[pageIndex][i] = activeDoc->undoStack[pageIndex][i + 1];
+    }
+    activeDoc->undoStack[pageIndex][activeDoc->undoTop[pageIndex]] = takePageSnapshot(activeDoc->currentPagePtr);
+}
+
+// Returns the snapshot (caller owns the reference) or nullptr when empty
+PageSlab* popUndo(int pageIndex) {
+    if (pageIndex < 0 || pageIndex >= (int)activeDoc->undoTop.size()) return nullptr;
+    if (activeDoc->undoTop[pageIndex] == -1) return nullptr;
+    PageSlab* state = activeDoc->undoStack[pageIndex][activeDoc->undoTop[pageIndex]];
+    activeDoc->undoStack[pageIndex][activeDoc->undoTop[pageIndex]] = nullptr;
+    activeDoc->undoTop[pageIndex]--; return state;
+}
+
+PageSlab* popRedo(int pageIndex) {
+    if (pageIndex < 0 || pageIndex >= (int)activeDoc->undoTop.size()) return nullptr;
+    if (activeDoc->redoTop[pageIndex] == -1) return nullptr;
+    PageSlab* state = activeDoc->redoStack[pageIndex][activeDoc->redoTop[pageIndex]];
+    activeDoc->redoStack[pageIndex][activeDoc->redoTop[pageIndex]] = nullptr;
+    activeDoc->redoTop[pageIndex]--; return state;
+}
+
+/**
+ * Scrambled View (Encrypt/Decrypt Toggle)
+ * While encrypted, the pages show the cipher text but the plain pages are kept
+ * as snapshots. Decrypting with the key that scrambled them puts those slabs
+ * back directly, without running the cipher or copying any line bytes.
+ */
+void discardScrambledView() {
+    for (int i = 0; i < (int)activeDoc->plainSnapshot.size(); ++i) releaseSlab(activeDoc->plainSnapshot[i]);
+    activeDoc->plainSnapshot.clear();
+    activeDoc->cipherImage.clear();
+}
+
+// Shows the cipher bytes as pages; takes over the plain snapshot's references.
+// cipher is an encrypted payload (key fingerprint + serialized document).
+void installScrambledView(vector<PageSlab*>& snapshot, string cipher) {
+    discardScrambledView();
+    activeDoc->plainSnapshot.swap(snapshot);
+    activeDoc->cipherImage = move(cipher);
+    deserializeDocument(activeDoc->cipherImage); // Rebuilds list with scrambled text
+    activeDoc->isEncrypted = true;
+}
+
+// Fast decrypt path: puts the kept plain slabs back if the key matches
+bool restorePlainSnapshot(const string& keyAttempt) {
+    if (keyAttempt != activeDoc->encryptionKey || activeDoc->plainSnapshot.empty()) return false;
+    resetDocumentPages();
+    for (int i = 0; i < (int)activeDoc->plainSnapshot.size(); ++i) restorePageSnapshot(addNewPage(), activeDoc->plainSnapshot[i]);
+    activeDoc->plainSnapshot.clear();
+    activeDoc->currentPagePtr = activeDoc->headPage;
+    discardScrambledView();
+    activeDoc->isEncrypted = false;
+    return true;
+}
+
+// plain is a decrypted payload whose key fingerprint has been checked
+void installDecryptedDocument(string_view plain) {
+    deserializeDocument(plain.substr(key_fingerprint_length)); // Rebuilds list with clean text
+    discardScrambledView();
+    activeDoc->isEncrypted = false;
+}
+
+void scrambleDocument(const string& key) {
+    activeDoc->encryptionKey = key;
+    vector<PageSlab*> snapshot = snapshotDocument();
+    installScrambledView(snapshot, encrypt(serializeSnapshot(snapshot, nullptr, getKeyFingerprint(key)), key));
+}
+
+// Returns false (and leaves the document scrambled) when the key is wrong
+bool unscrambleDocument(const string& keyAttempt) {
+    if (restorePlainSnapshot(keyAttempt)) return true;
+    string plain = decrypt(activeDoc->cipherImage, keyAttempt);
+    if (!matchesKeyFingerprint(plain, keyAttempt)) return false;
+    installDecryptedDocument(plain);
+    return true;
+}
+
+/**
+ * Background Encrypt/Decrypt
+ * The cipher runs on a worker over a snapshot; the result is installed on the
+ * UI thread only if nothing was edited in the meantime. The document takes
+ * the new key only then, so a cancelled encrypt leaves the old key in place.
+ */
+void startScrambleTask(const string& key) {
+    BackgroundTask* task = new BackgroundTask(TASK_CIPHER, "Encrypting");
+    task->snapshot = snapshotDocument();
+    task->work = [key](BackgroundTask& t) {
+        t.data = serializeSnapshot(t.snapshot, &t, getKeyFingerprint(key));
+        t.succeeded = runCipherInChunks(t.data, key, true, t);
+    };
+    task->complete = [key](BackgroundTask& t) {
+        if (!t.succeeded) t.message = "Encryption cancelled.";
+        else if (t.startVersion != activeDoc->documentVersion) t.message = "Document changed while encrypting. Press 'E' again.";
+        else {
+            activeDoc->encryptionKey = key;
+            installScrambledView(t.snapshot, move(t.data));
+            t.replacesDocument = true;
+            t.message = "Document Scrambled!";
+        }
+    };
+    startBackgroundTask(task);
+}
+
+// Returns true if the document was restored immediately (no task needed)
+bool startUnscrambleTask(const string& keyAttempt) {
+    if (restorePlainSnapshot(keyAttempt)) return true;
+    BackgroundTask* task = new BackgroundTask(TASK_CIPHER, "Decrypting");
+    task->data = activeDoc->cipherImage;
+    task->work = [keyAttempt](BackgroundTask& t) {
+        t.succeeded = runCipherInChunks(t.data, keyAttempt, false, t);
+    };
+    task->complete = [keyAttempt](BackgroundTask& t) {
+        if (!t.succeeded) t.message = "Decryption cancelled. Document is still encrypted.";
+        else if (t.startVersion != activeDoc->documentVersion) t.message = "Document changed while decrypting. Press 'E' again.";
+        else if (!matchesKeyFingerprint(t.data, keyAttempt)) t.message = "Wrong key. Document is still encrypted.";
+        else {
+            installDecryptedDocument(t.data);
+            t.replacesDocument = true;
+            t.message = "Document Restored!";
+        }
+    };
+    startBackgroundTask(task);
+    return false;
+}
+
+/**
+ * Search and Search History Management
+ */
+string toUpper(string s) {
+    string result = "";
+    for (int i = 0; i < s.length(); ++i) {
+        if (s[i] >= 'a' && s[i] <= 'z') result += s[i] - 32;
+        else result += s[i];
+    }
+    return result;
+}
+
+string getSearchTerm() {
+    updateMainStatusTemp("Search Mode: Type word and press [Enter]. [Backspace] works.");
+    int inputY = STATUS_BAR_Y + 2; gotoxy(0, inputY); cout << "Search: ";
+    string term = ""; char c; showCursor();
+    while (true) {
+        c = readKey();
+        if (c == 13) break;
+        else if (c == 8) {
+            if (!term.empty()) {
+                term = term.substr(0, term.length() - 1);
+                gotoxy(8 + term.length(), inputY); cout << " "; gotoxy(8 + term.length(), inputY);
+            }
+        }
+        else { term += c; cout << c; }
+    }
+    hideCursor(); clearLine(inputY); return term;
+}
+
+/**
+ * SearchMatch Structure
+ * One hit of the search term: page index, storage line and column.
+ */
+struct SearchMatch {
+    int page;
+    int line;
+    int column;
+};
+
+// Case-insensitive, non-overlapping matches on one page (same rule as the
+// highlighter in displayPageContent); reads only the slab, so worker-safe
+void findMatchesInSlab(const PageSlab* slab, const string& upperTerm, int page, vector<SearchMatch>& out) {
+    if (upperTerm.empty()) return;
+    string upperLine;
+    for (int i = 0; i < MAX_LINES_PER_PAGE_STORAGE; ++i) {
+        int length = slab->lineLength(i);
+        if (length < (int)upperTerm.length()) continue;
+        upperLine.assign(slab->text, slab->lineStart(i), length);
+        for (int c = 0; c < length; ++c) {
+            if (upperLine[c] >= 'a' && upperLine[c] <= 'z') upperLine[c] -= 32;
+        }
+        size_t pos = upperLine.find(upperTerm, 0);
+        while (pos != string::npos) {
+            SearchMatch match;
+            match.page = page; match.line = i; match.column = (int)pos;
+            out.push_back(match);
+            pos = upperLine.find(upperTerm, pos + upperTerm.length());
+        }
+    }
+}
+
+int countMatchesInSlab(const PageSlab* slab, const string& upperTerm) {
+    vector<SearchMatch> matches;
+    findMatchesInSlab(slab, upperTerm, 0, matches);
+    return matches.size();
+}
+
+/**
+ * Parallel Document Search
+ * The snapshot is cut into chunks of pages, each chunk is a pool job, and
+ * the calling thread helps until all are done. Per-chunk match lists are
+ * concatenated in chunk order, so the result is in page order and identical
+ * to a sequential scan.
+ */
+const int search_pages_per_job = 64;
+
+vector<SearchMatch> findMatchesInSnapshot(const vector<PageSlab*>& snapshot, const string& upperTerm, BackgroundTask* task = nullptr) {
+    PERF_SCOPE(PERF_SEARCH_DOCUMENT, snapshot.size());
+    int pageCount = snapshot.size();
+    int chunkCount = (pageCount + search_pages_per_job - 1) / search_pages_per_job;
+    vector<vector<SearchMatch>> chunkMatches(chunkCount);
+    atomic<int> remaining(chunkCount);
+    atomic<int> pagesDone(0);
+
+    for (int c = 0; c < chunkCount; ++c) {
+        postWorkerJob([&, c] {
+            int first = c * search_pages_per_job;
+            int last = (first + search_pages_per_job < pageCount) ? first + search_pages_per_job : pageCount;
+            if (task == nullptr || !task->isCancelled()) {
+                for (int p = first; p < last; ++p) findMatchesInSlab(snapshot[p], upperTerm, p, chunkMatches[c]);
+                int done = (pagesDone += last - first);
+                if (task != nullptr) task->report("", done, pageCount);
+            }
+            remaining--;
+        });
+    }
+    runWorkerJobsUntil([&] { return remaining.load() == 0; });
+
+    size_t total = 0;
+    for (int c = 0; c < chunkCount; ++c) total += chunkMatches[c].size();
+    vector<SearchMatch> matches;
+    matches.reserve(total);
+    for (int c = 0; c < chunkCount; ++c) matches.insert(matches.end(), chunkMatches[c].begin(), chunkMatches[c].end());
+    return matches;
+}
+
+int searchAndHighlight(string term) {
+    if (activeDoc->currentPagePtr == nullptr || term.empty()) return 0;
+    PERF_SCOPE(PERF_SEARCH_PAGE, activeDoc->currentPagePtr->slab->text.length());
+    return countMatchesInSlab(activeDoc->currentPagePtr->slab, toUpper(term));
+}
+
+/**
+ * Document-wide Search (background)
+ * Runs the parallel search over a snapshot. A new search cancels the
+ * previous one; the totals appear in the status bar when done.
+ */
+void startDocumentSearchTask(const string& term) {
+    cancelTaskKind(TASK_SEARCH);
+    BackgroundTask* task = new BackgroundTask(TASK_SEARCH, "Searching document");
+    task->snapshot = snapshotDocument();
+    string upperTerm = toUpper(term);
+    shared_ptr<vector<SearchMatch>> matches = make_shared<vector<SearchMatch>>();
+
+    task->work = [upperTerm, matches](BackgroundTask& t) {
+        *matches = findMatchesInSnapshot(t.snapshot, upperTerm, &t);
+        t.succeeded = !t.isCancelled();
+    };
+    task->complete = [term, matches](BackgroundTask& t) {
+        if (!t.succeeded || t.startVersion != activeDoc->documentVersion) return;
+        long long total = matches->size();
+        int pagesWithMatches = 0;
+        for (int i = 0; i < (int)matches->size(); ++i) {
+            if (i == 0 || (*matches)[i].page != (*matches)[i - 1].page) pagesWithMatches++;
+        }
+        t.message = "'" + term + "': " + to_string(total) + " matches in document on " + to_string(pagesWithMatches) + " pages.";
+        if (activeDoc->isSearchMode) t.message += " Any key clears highlights.";
+    };
+    startBackgroundTask(task);
+}
+
+void addSearchToHistory(string term, int matches) {
+    activeDoc->recentSearches[activeDoc->searchHistoryTop] = term; activeDoc->recentCount[activeDoc->searchHistoryTop] = matches;
+    activeDoc->searchHistoryTop = (activeDoc->searchHistoryTop + 1) % search_history_size;
+    if (activeDoc->searchHistoryTotal < search_history_size) activeDoc->searchHistoryTotal++;
+}
+
+void displaySearchHistory() {
+    int historyLineY = STATUS_BAR_Y + 1; clearLine(historyLineY);
+    gotoxy(col1_start_X, historyLineY); cout << "History: ";
+    int startIndex = (activeDoc->searchHistoryTop - 1 + search_history_size) % search_history_size;
+    for (int i = 0; i < activeDoc->searchHistoryTotal; ++i) {
+        int index = (startIndex - i + search_history_size) % search_history_size;
+        cout << activeDoc->recentSearches[index] << "(" << activeDoc->recentCount[index] << ") ";
     }
 }
 
@@ -542,15 +2522,16 @@ string applyAlignment(string line, bool isLastLineOfParagraph) {
 }
 
 void processParagraph(string paragraph) {
-    if (currentPagePtr == nullptr) return;
+    if (activeDoc->currentPagePtr == nullptr) return;
+    PERF_SCOPE(PERF_PROCESS_PARAGRAPH, paragraph.length());
     int currentLineIndex = 0;
-    while (currentLineIndex < MAX_LINES_PER_PAGE_STORAGE && !currentPagePtr->content[currentLineIndex].empty()) {
+    while (currentLineIndex < MAX_LINES_PER_PAGE_STORAGE && !activeDoc->currentPagePtr->isLineEmpty(currentLineIndex)) {
         currentLineIndex++;
     }
     if (currentLineIndex >= MAX_LINES_PER_PAGE_STORAGE) {
-        updateMainStatusTemp("Page full - move to next page. Press any key."); _getch(); return;
+        updateMainStatusTemp("Page full - move to next page. Press any key."); readKey(); return;
     }
-    string lineBuffer = currentPagePtr->content[currentLineIndex];
+    string lineBuffer = activeDoc->currentPagePtr->getLine(currentLineIndex);
     string currentWord = "";
     paragraph += " ";
     for (int i = 0; i < paragraph.length(); ++i) {
@@ -562,10 +2543,10 @@ void processParagraph(string paragraph) {
                 lineBuffer += (spaceNeeded ? " " : "") + currentWord;
             }
             else {
-                currentPagePtr->content[currentLineIndex] = applyAlignment(lineBuffer, false);
+                activeDoc->currentPagePtr->setLine(currentLineIndex, applyAlignment(lineBuffer, false));
                 currentLineIndex++;
                 if (currentLineIndex >= MAX_LINES_PER_PAGE_STORAGE) {
-                    updateMainStatusTemp("Page full. Word truncated. Press any key."); _getch();
+                    updateMainStatusTemp("Page full. Word truncated. Press any key."); readKey();
                     currentWord = ""; break;
                 }
                 if (currentWord.length() > col_width) lineBuffer = currentWord.substr(0, col_width);
@@ -576,18 +2557,20 @@ void processParagraph(string paragraph) {
         else { currentWord += c; }
     }
     if (currentLineIndex < MAX_LINES_PER_PAGE_STORAGE && !lineBuffer.empty()) {
-        currentPagePtr->content[currentLineIndex] = applyAlignment(lineBuffer, true);
+        activeDoc->currentPagePtr->setLine(currentLineIndex, applyAlignment(lineBuffer, true));
     }
+    indexPage(activeDoc->currentPagePtr);
+    markDocumentChanged();
 }
 
 void handleTextInput(int currentPage) {
-    if (currentPagePtr == nullptr) return;
+    if (activeDoc->currentPagePtr == nullptr) return;
     updateMainStatusTemp("Text Input Mode: Type paragraph, press [Enter] when done.");
     int inputY = STATUS_BAR_Y + 2;
     gotoxy(0, inputY); cout << "> ";
     string paragraph = ""; char c; showCursor();
     while (true) {
-        c = _getch();
+        c = readKey();
         if (c == 13) break;
         else if (c == 8) {
             if (!paragraph.empty()) {
@@ -605,8 +2588,12 @@ void handleTextInput(int currentPage) {
  * File I/O and Document Persistence
  */
 void clearAllUndoRedoStacks() {
-    for (int i = 0; i < 100; ++i) {
-        undoTop[i] = -1; redoTop[i] = -1;
+    for (int i = 0; i < (int)activeDoc->undoTop.size(); ++i) {
+        for (int d = 0; d < history_depth; ++d) {
+            releaseSlab(activeDoc->undoStack[i][d]); activeDoc->undoStack[i][d] = nullptr;
+            releaseSlab(activeDoc->redoStack[i][d]); activeDoc->redoStack[i][d] = nullptr;
+        }
+        activeDoc->undoTop[i] = -1; activeDoc->redoTop[i] = -1;
     }
 }
 
@@ -614,6 +2601,7 @@ string readFile(string filename) {
     ifstream file(filename.c_str(), ios::binary);
     if (!file.is_open()) return "";
     file.seekg(0, ios::end); int length = file.tellg();
+    PERF_SCOPE(PERF_READ_FILE, length);
     file.seekg(0, ios::beg);
     if (length == 0) { file.close(); return ""; }
     char* buffer = new char[length];
@@ -623,132 +2611,371 @@ string readFile(string filename) {
     return data;
 }
 
-void writeFile(string filename, string data) {
+bool writeFile(string filename, const string& data) {
+    PERF_SCOPE(PERF_WRITE_FILE, data.length());
     ofstream file(filename.c_str(), ios::binary);
-    if (!file.is_open()) return;
+    if (!file.is_open()) return false;
     file.write(data.c_str(), data.length());
     file.close();
+    return !file.fail();
+}
+
+// Replaces the document with freshly loaded text (UI thread)
+void installLoadedDocument(string_view data, const string& key) {
+    clearAllUndoRedoStacks();
+    discardScrambledView();
+    deserializeDocument(data);
+    activeDoc->isEncrypted = false;
+    activeDoc->encryptionKey = key;
 }
 
+/**
+ * Save runs in the background: the prompts happen here, then a worker
+ * serializes a snapshot, encrypts it and writes the file.
+ */
 void saveDocumentToFile() {
+    if (isTaskKindRunning(TASK_SAVE)) {
+        updateMainStatusTemp("A save is already in progress.");
+        return;
+    }
     updateMainStatusTemp("Enter filename to save: ");
     string filename = getSimpleTextInput(26);
     if (filename.empty()) return;
-    if (!isEncrypted) {
+
+    BackgroundTask* task = new BackgroundTask(TASK_SAVE, "Saving " + filename);
+    bool scrambled = activeDoc->isEncrypted;
+    if (!scrambled) {
         updateMainStatusTemp("Encrypting before save...");
-        if (encryptionKey == "") {
+        if (activeDoc->encryptionKey == "") {
             updateMainStatusTemp("Enter Encryption Key (seed): ");
-            encryptionKey = getSimpleTextInput(28);
-            if (encryptionKey == "") return;
+            activeDoc->encryptionKey = getSimpleTextInput(28);
+            if (activeDoc->encryptionKey == "") { delete task; return; }
         }
-        string data = serializeDocument();
-        string encrypted = encrypt(data, encryptionKey);
-        unsigned char sum = calculateChecksum(encrypted);
-        encrypted += sum;
-        writeFile(filename, encrypted);
+        task->snapshot = snapshotDocument();
     }
     else {
-        string data = serializeDocument();
-        writeFile(filename, data);
+        task->data = activeDoc->cipherImage; // Already the encrypted payload
     }
-    updateMainStatusTemp("File saved securely! Press any key.");
-    _getch();
+
+    string key = activeDoc->encryptionKey;
+    task->work = [scrambled, key, filename](BackgroundTask& t) {
+        if (!scrambled) {
+            t.data = serializeSnapshot(t.snapshot, &t, getKeyFingerprint(key));
+            if (!runCipherInChunks(t.data, key, true, t)) return;
+        }
+        t.data = buildEncryptedFile(t.data);
+        if (t.isCancelled()) return;
+        t.report("writing", 0, 1);
+        t.succeeded = writeFile(filename, t.data);
+    };
+    task->complete = [filename](BackgroundTask& t) {
+        if (t.isCancelled()) t.message = "Save cancelled. " + filename + " was not written.";
+        else if (!t.succeeded) t.message = "Could not write " + filename + ".";
+        else {
+            activeDoc->name = filename;
+            t.message = "File saved securely!";
+        }
+    };
+    startBackgroundTask(task);
+}
+
+// Second load stage: decrypts and verifies on a worker, then installs.
+// Current files are checked against the key fingerprint; legacy files carry
+// no fingerprint, so only their checksum can be checked.
+void startDecryptLoadTask(string fileData, const string& key, const string& filename) {
+    BackgroundTask* task = new BackgroundTask(TASK_LOAD, "Opening");
+    task->data = move(fileData);
+    shared_ptr<string> decrypted = make_shared<string>();
+    bool legacy = !isEncryptedFile(task->data);
+
+    task->work = [key, decrypted, legacy](BackgroundTask& t) {
+        if (!legacy) {
+            extractFileCipher(t.data, *decrypted);
+            if (!runCipherInChunks(*decrypted, key, false, t)) return;
+            t.succeeded = matchesKeyFingerprint(*decrypted, key);
+            if (t.succeeded) decrypted->erase(0, key_fingerprint_length);
+            return;
+        }
+        unsigned char storedSum = (unsigned char)t.data[t.data.length() - 1];
+        *decrypted = t.data.substr(0, t.data.length() - 1);
+        if (!runCipherInChunks(*decrypted, key, false, t)) return;
+
+        string reEncrypted = *decrypted;
+        if (!runCipherInChunks(reEncrypted, key, true, t)) return;
+        t.succeeded = (calculateChecksum(reEncrypted) == storedSum);
+    };
+    task->complete = [key, decrypted, legacy, filename](BackgroundTask& t) {
+        if (t.isCancelled()) { t.message = "Open cancelled."; return; }
+        if (t.succeeded) {
+            installLoadedDocument(*decrypted, key);
+            t.message = "Decrypted file loaded successfully.";
+        }
+        else if (!legacy) {
+            t.message = "Wrong key. The file was not opened.";
+            return;
+        }
+        else {
+            installLoadedDocument(t.data, "");
+            t.message = "Decryption FAILED: Key mismatch or tampering detected. Loaded as plain text.";
+        }
+        activeDoc->name = filename;
+        t.replacesDocument = true;
+    };
+    startBackgroundTask(task);
 }
 
-bool loadDocumentFromFile(string mainStatus) {
+/**
+ * Load runs in the background: a worker reads and classifies the file; if it
+ * looks encrypted the completion asks for the key and starts the decrypt stage.
+ */
+void loadDocumentFromFile(string mainStatus) {
+    if (isTaskKindRunning(TASK_LOAD) || isTaskKindRunning(TASK_CIPHER)) {
+        updateMainStatusTemp("Please wait for the current open/encrypt to finish.");
+        return;
+    }
     updateMainStatusTemp("Enter filename to open: ");
     string filename = getSimpleTextInput(25);
-    if (filename.empty()) { updateMainStatus(mainStatus); return false; }
-    string fullDoc = readFile(filename);
-    if (fullDoc.empty()) {
-        updateMainStatusTemp("File not found or empty. Press any key.");
-        _getch(); updateMainStatus(mainStatus);
-        return false;
-    }
-    clearAllUndoRedoStacks();
+    if (filename.empty()) { updateMainStatus(mainStatus); return; }
 
-    bool loadSuccessful = false;
-    if (isLikelyEncrypted(fullDoc) && fullDoc.length() > 0) {
-        unsigned char storedSum = (unsigned char)fullDoc[fullDoc.length() - 1];
-        string dataToCheck = fullDoc.substr(0, fullDoc.length() - 1);
-        unsigned char initialChecksum = calculateChecksum(dataToCheck);
+    BackgroundTask* task = new BackgroundTask(TASK_LOAD, "Opening " + filename);
+    task->work = [filename](BackgroundTask& t) {
+        t.report("reading", 0, 1);
+        t.data = readFile(filename);
+        if (t.data.empty() || t.isCancelled()) return;
 
-        if (initialChecksum == storedSum) {
-            string currentKey = encryptionKey;
+        // succeeded = "encrypted and the stored checksum matches"
+        t.report("analyzing", 1, 2);
+        if (isEncryptedFile(t.data)) {
+            string cipher;
+            t.succeeded = extractFileCipher(t.data, cipher);
+        }
+        else t.succeeded = isLegacyEncryptedFile(t.data);
+    };
+    task->complete = [filename](BackgroundTask& t) {
+        if (t.isCancelled()) { t.message = "Open cancelled."; return; }
+        if (t.data.empty()) { t.message = "File not found or empty."; return; }
+        if (t.succeeded) {
+            string currentKey = activeDoc->encryptionKey;
             if (currentKey == "") {
                 updateMainStatusTemp("Encrypted file detected by analysis. Enter Key: ");
                 currentKey = getSimpleTextInput(28);
             }
+            startDecryptLoadTask(move(t.data), currentKey, filename);
+            return;
+        }
+        if (isEncryptedFile(t.data)) { t.message = "Encrypted file is damaged (checksum mismatch). It was not opened."; return; }
+        installLoadedDocument(t.data, "");
+        activeDoc->name = filename;
+        t.message = "Plain text (or corrupted) file loaded.";
+        t.replacesDocument = true;
+    };
+    startBackgroundTask(task);
+}
 
-            string decryptedData = decrypt(dataToCheck, currentKey);
-            string reEncrypted = encrypt(decryptedData, currentKey);
-            unsigned char checkSumOnDecrypted = calculateChecksum(reEncrypted);
+/**
+ * Document Session
+ * Every open document lives in sessionDocuments; switching only changes
+ * activeDoc, so it is instant. Pages and slabs of all documents come from
+ * the same pools. When the estimated memory of the session goes over
+ * sessionMemoryLimit, the least recently used inactive documents are
+ * evicted: their content is written to a swap file (the cipher bytes if the
+ * document is scrambled, so plain text never reaches the disk) and their
+ * pages go back to the pools. Switching to an evicted document reads it
+ * back; its undo history does not survive the eviction.
+ */
+vector<Document*> sessionDocuments(1, activeDoc);
+long long sessionMemoryLimit = 256LL << 20; // Bytes; 0 disables eviction
+long long sessionClock = 0;
+int nextDocumentId = 2;
 
-            if (checkSumOnDecrypted == storedSum) {
-                deserializeDocument(decryptedData);
-                isEncrypted = false;
-                encryptionKey = currentKey;
-                updateMainStatusTemp("Decrypted file loaded successfully. Press any key.");
-                loadSuccessful = true;
-            }
-            else {
-                updateMainStatusTemp("Decryption FAILED: Key mismatch or tampering detected. Press key.");
-                loadSuccessful = false;
-            }
-        }
+// Approximate heap bytes held by a document (shared slabs are counted once per holder)
+long long estimateDocumentMemory(Document* doc) {
+    if (doc->isEvicted) return 0;
+    long long bytes = sizeof(Document) + doc->cipherImage.capacity();
+    for (int i = 0; i < (int)doc->pageTable.size(); ++i) {
+        bytes += sizeof(DocumentPage) + sizeof(PageSlab) + doc->pageTable[i]->slab->text.capacity();
     }
+    for (int i = 0; i < (int)doc->undoTop.size(); ++i) {
+        for (int d = 0; d <= doc->undoTop[i]; ++d) bytes += sizeof(PageSlab) + doc->undoStack[i][d]->text.capacity();
+        for (int d = 0; d <= doc->redoTop[i]; ++d) bytes += sizeof(PageSlab) + doc->redoStack[i][d]->text.capacity();
+    }
+    for (int i = 0; i < (int)doc->plainSnapshot.size(); ++i) bytes += sizeof(PageSlab) + doc->plainSnapshot[i]->text.capacity();
+    return bytes;
+}
 
-    if (!loadSuccessful) {
-        deserializeDocument(fullDoc);
-        isEncrypted = false;
-        encryptionKey = "";
-        updateMainStatusTemp("Plain text (or corrupted) file loaded. Press any key.");
+long long estimateSessionMemory() {
+    long long total = 0;
+    for (int i = 0; i < (int)sessionDocuments.size(); ++i) total += estimateDocumentMemory(sessionDocuments[i]);
+    return total;
+}
+
+bool documentHasTasks(Document* doc) {
+    for (int i = 0; i < (int)activeTasks.size(); ++i) {
+        if (activeTasks[i]->document == doc) return true;
     }
+    return false;
+}
 
-    _getch();
-    return true;
+string getSwapPath(Document* doc) {
+    static const string sessionTag = to_string(chrono::system_clock::now().time_since_epoch().count());
+    return "doceditor-" + sessionTag + "-" + to_string(doc->id) + ".swap";
 }
 
-/**
- * Display and UI Rendering Logic
- */
-string currentSearchTerm = "";
-bool isSearchMode = false;
+// Releases every page, history slot and snapshot of the active document
+void releaseDocumentContent() {
+    clearAllUndoRedoStacks();
+    discardScrambledView();
+    releaseAllPages();
+    clearPageIndex();
+    activeDoc->nextPageGlobalIndex = 0;
+    activeDoc->undoStack.clear(); activeDoc->redoStack.clear();
+    activeDoc->undoTop.clear(); activeDoc->redoTop.clear();
+}
 
-void displayPageContent(int currentPage) {
-    if (currentPagePtr == nullptr) return;
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+// Writes an inactive document to its swap file and frees its pages; false leaves it in memory
+bool evictDocument(Document* doc) {
+    if (doc == activeDoc || doc->isEvicted || documentHasTasks(doc)) return false;
+    ActiveDocumentScope scope(doc);
+    string path = getSwapPath(doc);
+    if (!writeFile(path, activeDoc->isEncrypted ? activeDoc->cipherImage : serializeDocument())) return false;
+    doc->evictedPageNumber = getPageDisplayNumber(activeDoc->currentPagePtr);
+    releaseDocumentContent();
+    doc->swapPath = path;
+    doc->isEvicted = true;
+    return true;
+}
 
-    for (int y = 0; y < page_height; ++y) {
-        string blankLine(col_width, ' ');
-        gotoxy(col1_start_X, page_start_Y + y); cout << blankLine;
-        gotoxy(col2_start_X, page_start_Y + y); cout << blankLine;
+// Reads an evicted document back from its swap file; false if the file is gone
+bool restoreDocument(Document* doc) {
+    if (!doc->isEvicted) return true;
+    string data = readFile(doc->swapPath);
+    if (data.empty()) return false;
+    ActiveDocumentScope scope(doc);
+    if (activeDoc->isEncrypted) {
+        activeDoc->cipherImage = move(data);
+        deserializeDocument(activeDoc->cipherImage); // Scrambled view without kept plain pages
     }
+    else {
+        deserializeDocument(data);
+    }
+    DocumentPage* page = getPageByNumber(doc->evictedPageNumber);
+    if (page != nullptr) activeDoc->currentPagePtr = page;
+    remove(doc->swapPath.c_str());
+    doc->swapPath = "";
+    doc->isEvicted = false;
+    return true;
+}
 
-    string allLines[MAX_LINES_PER_PAGE_STORAGE];
-    bool isParaStart[MAX_LINES_PER_PAGE_STORAGE];
-    int totalLines = 0;
-
-    for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) {
-        string line = currentPagePtr->content[l];
-        if (!line.empty()) {
-            allLines[totalLines] = line;
-            isParaStart[totalLines] = (l == 0) || (l == page_height) ||
-                (l > 0 && currentPagePtr->content[l - 1].empty());
-            totalLines++;
+// Evicts least recently used inactive documents until the session fits its limit
+void enforceSessionMemoryLimit() {
+    if (sessionMemoryLimit <= 0) return;
+    while (estimateSessionMemory() > sessionMemoryLimit) {
+        Document* oldest = nullptr;
+        for (int i = 0; i < (int)sessionDocuments.size(); ++i) {
+            Document* doc = sessionDocuments[i];
+            if (doc == activeDoc || doc->isEvicted || documentHasTasks(doc)) continue;
+            if (oldest == nullptr || doc->lastUsed < oldest->lastUsed) oldest = doc;
         }
+        if (oldest == nullptr || !evictDocument(oldest)) return;
     }
+}
 
-    if (totalLines == 0) return;
+bool switchToDocument(Document* doc) {
+    if (!restoreDocument(doc)) return false;
+    activeDoc = doc;
+    doc->lastUsed = ++sessionClock;
+    enforceSessionMemoryLimit();
+    return true;
+}
 
-    int targetCol1Lines = (totalLines / 2) + (totalLines % 2);
-    int splitIndex = targetCol1Lines;
+// Adds an empty one-page document to the session and makes it active
+Document* createDocument() {
+    Document* doc = new Document(nextDocumentId, "Untitled " + to_string(nextDocumentId));
+    nextDocumentId++;
+    sessionDocuments.push_back(doc);
+    {
+        ActiveDocumentScope scope(doc);
+        activeDoc->currentPagePtr = addNewPage();
+    }
+    switchToDocument(doc);
+    return doc;
+}
 
-    if (splitIndex > 0 && splitIndex < totalLines && !isParaStart[splitIndex]) {
-        int paraStart = splitIndex - 1;
-        while (paraStart > 0 && !isParaStart[paraStart]) paraStart--;
-        int paraEnd = splitIndex;
-        while (paraEnd < totalLines - 1 && !isParaStart[paraEnd + 1]) paraEnd++;
+int getDocumentNumber(Document* doc) {
+    for (int i = 0; i < (int)sessionDocuments.size(); ++i) {
+        if (sessionDocuments[i] == doc) return i + 1;
+    }
+    return 0;
+}
+
+// Closes a document without background work; the last open document cannot be closed
+bool closeDocument(Document* doc) {
+    int number = getDocumentNumber(doc);
+    if (number == 0 || sessionDocuments.size() < 2 || documentHasTasks(doc)) return false;
+    if (doc == activeDoc && !switchToDocument(sessionDocuments[(number < (int)sessionDocuments.size()) ? number : number - 2])) return false;
+    {
+        ActiveDocumentScope scope(doc);
+        releaseDocumentContent();
+    }
+    if (doc->isEvicted) remove(doc->swapPath.c_str());
+    sessionDocuments.erase(sessionDocuments.begin() + (number - 1));
+    delete doc;
+    return true;
+}
+
+// Shutdown: releases every document and removes swap files (tasks must be finished)
+void closeAllDocuments() {
+    for (int i = 0; i < (int)sessionDocuments.size(); ++i) {
+        Document* doc = sessionDocuments[i];
+        {
+            ActiveDocumentScope scope(doc);
+            releaseDocumentContent();
+        }
+        if (doc->isEvicted) remove(doc->swapPath.c_str());
+        if (doc != activeDoc) delete doc;
+    }
+    sessionDocuments.assign(1, activeDoc);
+    activeDoc->isEvicted = false;
+}
+
+/**
+ * Column Layout
+ * A page's non-empty lines are split between the two columns. The split
+ * starts at the middle and moves to the nearer paragraph boundary, so the
+ * columns stay balanced without a paragraph running across them. The screen
+ * and the exporter both lay pages out here.
+ */
+struct PageColumns {
+    string lines[MAX_LINES_PER_PAGE_STORAGE];
+    bool isParaStart[MAX_LINES_PER_PAGE_STORAGE];
+    int storageLine[MAX_LINES_PER_PAGE_STORAGE]; // Slab line each entry came from
+    int totalLines;
+    int splitIndex; // Entries before it go in column 1
+};
+
+// Reads only the slab, so worker-safe
+void layoutPageColumns(const PageSlab* slab, PageColumns& columns) {
+    int totalLines = 0;
+    for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) {
+        if (slab->lineLength(l) != 0) {
+            columns.lines[totalLines].assign(slab->text, slab->lineStart(l), slab->lineLength(l));
+            columns.isParaStart[totalLines] = (l == 0) || (l == page_height) ||
+                (l > 0 && slab->lineLength(l - 1) == 0);
+            columns.storageLine[totalLines] = l;
+            totalLines++;
+        }
+    }
+    columns.totalLines = totalLines;
+
+    int targetCol1Lines = (totalLines / 2) + (totalLines % 2);
+    int splitIndex = targetCol1Lines;
+    const bool* isParaStart = columns.isParaStart;
+
+    if (splitIndex > 0 && splitIndex < totalLines && !isParaStart[splitIndex]) {
+        int paraStart = splitIndex - 1;
+        while (paraStart > 0 && !isParaStart[paraStart]) paraStart--;
+        int paraEnd = splitIndex;
+        while (paraEnd < totalLines - 1 && !isParaStart[paraEnd + 1]) paraEnd++;
 
         int diff_A = abs(paraStart - (totalLines - paraStart));
         int diff_B = abs((paraEnd + 1) - (totalLines - (paraEnd + 1)));
@@ -756,6 +2983,49 @@ void displayPageContent(int currentPage) {
         if (diff_A < diff_B) splitIndex = paraStart;
         else splitIndex = paraEnd + 1;
     }
+    columns.splitIndex = splitIndex;
+}
+
+// Start offsets of case-insensitive, non-overlapping matches (the search
+// rule). upperLine is scratch space, reused across calls.
+void findHighlights(const string& line, const string& upperTerm, vector<size_t>& starts, string& upperLine) {
+    starts.clear();
+    if (upperTerm.empty() || line.length() < upperTerm.length()) return;
+    upperLine = line;
+    for (size_t c = 0; c < upperLine.length(); ++c) {
+        if (upperLine[c] >= 'a' && upperLine[c] <= 'z') upperLine[c] -= 32;
+    }
+    size_t foundPos = 0;
+    while ((foundPos = upperLine.find(upperTerm, foundPos)) != string::npos) {
+        starts.push_back(foundPos);
+        foundPos += upperTerm.length();
+    }
+}
+
+/**
+ * Display and UI Rendering Logic
+ */
+
+void displayPageContent(int currentPage) {
+    if (activeDoc->currentPagePtr == nullptr) return;
+    PERF_SCOPE(PERF_DISPLAY_PAGE, activeDoc->currentPagePtr->slab->text.length());
+
+    for (int y = 0; y < page_height; ++y) {
+        string blankLine(col_width, ' ');
+        gotoxy(col1_start_X, page_start_Y + y); cout << blankLine;
+        gotoxy(col2_start_X, page_start_Y + y); cout << blankLine;
+    }
+
+    PageColumns columns;
+    layoutPageColumns(activeDoc->currentPagePtr->slab, columns);
+    int totalLines = columns.totalLines;
+    int splitIndex = columns.splitIndex;
+    if (totalLines == 0) return;
+
+    bool highlighting = activeDoc->isSearchMode && !activeDoc->currentSearchTerm.empty();
+    string upperTerm = highlighting ? toUpper(activeDoc->currentSearchTerm) : "";
+    vector<size_t> matches;
+    string upperLine;
 
     for (int i = 0; i < totalLines; ++i) {
         int startX = (i < splitIndex) ? col1_start_X : col2_start_X;
@@ -763,20 +3033,17 @@ void displayPageContent(int currentPage) {
         if (lineY >= page_height) continue;
 
         gotoxy(startX, page_start_Y + lineY);
-        string line = allLines[i];
+        const string& line = columns.lines[i];
 
-        if (isSearchMode && !currentSearchTerm.empty()) {
-            string upperLine = toUpper(line);
-            string upperTerm = toUpper(currentSearchTerm);
+        if (highlighting) {
+            findHighlights(line, upperTerm, matches, upperLine);
             size_t lastPos = 0;
-            size_t foundPos = 0;
-
-            while ((foundPos = upperLine.find(upperTerm, lastPos)) != string::npos) {
-                cout << line.substr(lastPos, foundPos - lastPos);
-                SetConsoleTextAttribute(hConsole, BACKGROUND_RED | BACKGROUND_GREEN | BACKGROUND_INTENSITY);
-                cout << line.substr(foundPos, currentSearchTerm.length());
-                SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
-                lastPos = foundPos + currentSearchTerm.length();
+            for (size_t m = 0; m < matches.size(); ++m) {
+                cout << line.substr(lastPos, matches[m] - lastPos);
+                setHighlightColor();
+                cout << line.substr(matches[m], upperTerm.length());
+                resetTextColor();
+                lastPos = matches[m] + upperTerm.length();
             }
             cout << line.substr(lastPos);
         }
@@ -787,54 +3054,1205 @@ void displayPageContent(int currentPage) {
 }
 
 /**
- * Table of Contents (TOC) Generator
+ * Document Export
+ * Writes the document as paginated plain text, Markdown or HTML. Pages are
+ * streamed one at a time through layoutPageColumns(), so every format keeps
+ * the on-screen column split, and output goes through a fixed-size buffer:
+ * an export holds one page and one buffer whatever the document size. The
+ * table of contents comes from a first pass over the pages that writes each
+ * '#' heading as soon as it is found; the second pass writes the pages, with
+ * an anchor on every heading and the highlight term marked using the search
+ * rule (case-insensitive, non-overlapping).
  */
-void handleTOCView(int currentPage, string mainStatus) {
-    system("cls");
-    gotoxy(3, 1);
-    cout << "--- TABLE OF CONTENTS ---";
+enum ExportFormat { EXPORT_TEXT, EXPORT_MARKDOWN, EXPORT_HTML };
 
-    string titles[500]; int pages[500]; int cols[500];
-    int tocCount = 0;
+const size_t export_buffer_size = 64 * 1024;
 
-    DocumentPage* current = headPage;
-    while (current != nullptr) {
-        int p = getPageDisplayNumber(current);
-        for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) {
-            string line = current->content[l];
-            if (!line.empty() && line[0] == '#') {
-                if (tocCount < 500) {
-                    titles[tocCount] = line.substr(1);
-                    pages[tocCount] = p;
-                    cols[tocCount] = (l < page_height) ? 1 : 2;
-                    tocCount++;
-                }
+// Chosen by extension: .md/.markdown, .htm/.html, anything else is plain text
+ExportFormat getExportFormat(const string& filename) {
+    size_t dot = filename.find_last_of('.');
+    string extension = (dot == string::npos) ? "" : toUpper(filename.substr(dot + 1));
+    if (extension == "MD" || extension == "MARKDOWN") return EXPORT_MARKDOWN;
+    if (extension == "HTM" || extension == "HTML") return EXPORT_HTML;
+    return EXPORT_TEXT;
+}
+
+struct BufferedWriter {
+    ofstream file;
+    string buffer;
+    long long bytesWritten;
+    bool failed;
+
+    BufferedWriter(const string& filename)
+        : file(filename.c_str(), ios::binary), bytesWritten(0), failed(!file.is_open()) {
+        buffer.reserve(export_buffer_size);
+    }
+
+    void flush() {
+        if (!buffer.empty() && !failed) {
+            file.write(buffer.data(), buffer.length());
+            bytesWritten += buffer.length();
+            if (file.fail()) failed = true;
+        }
+        buffer.clear();
+    }
+
+    void write(const char* data, size_t length) {
+        if (buffer.length() + length > export_buffer_size) flush();
+        if (length >= export_buffer_size) {
+            // Too big to buffer: goes straight to the file
+            if (failed) return;
+            file.write(data, length);
+            bytesWritten += length;
+            if (file.fail()) failed = true;
+            return;
+        }
+        buffer.append(data, length);
+    }
+
+    void write(const string& text) { write(text.data(), text.length()); }
+    void write(const char* text) { write(text, strlen(text)); }
+    void put(char c) { if (buffer.length() == export_buffer_size) flush(); buffer += c; }
+
+    bool close() {
+        flush();
+        file.close();
+        return !failed && !file.fail();
+    }
+};
+
+/**
+ * Export Page Sources
+ * next() returns the next page (valid until the following call) or nullptr
+ * after the last one; rewind() goes back to page 1 for the second pass.
+ */
+struct ExportSource {
+    function<bool()> rewind;
+    function<const PageSlab*()> next;
+    function<int()> percentDone; // Of the current pass
+};
+
+// Pages from a snapshot (see snapshotDocument); safe on a worker thread
+ExportSource makeSnapshotSource(const vector<PageSlab*>& snapshot) {
+    ExportSource source;
+    shared_ptr<size_t> position = make_shared<size_t>(0);
+    const vector<PageSlab*>* pages = &snapshot;
+    source.rewind = [position] { *position = 0; return true; };
+    source.next = [pages, position]() -> const PageSlab* {
+        return (*position < pages->size()) ? (*pages)[(*position)++] : nullptr;
+    };
+    source.percentDone = [pages, position] {
+        return pages->empty() ? 100 : (int)(*position * 100 / pages->size());
+    };
+    return source;
+}
+
+// Reads a saved document a chunk at a time, splitting pages as
+// deserializeDocument() does. Only the bytes up to a page's last storage line
+// are kept, so one page is the most ever held.
+struct PageFileReader {
+    string path;
+    ifstream file;
+    vector<char> chunk;
+    size_t chunkPos, chunkLength;
+    long long fileSize, consumed;
+    bool escaped, finished, readFailed, isEncrypted;
+    string pageBytes;
+    int pageLines;   // Line delimiters kept for the current page
+    bool pageFull;   // The page's remaining bytes are skipped
+    PageSlab slab;
+
+    PageFileReader(const string& filename)
+        : path(filename), chunk(export_buffer_size), chunkPos(0), chunkLength(0), fileSize(0), consumed(0),
+        escaped(false), finished(true), readFailed(false), isEncrypted(false), pageLines(0), pageFull(false) {}
+
+    bool refill() {
+        file.read(chunk.data(), chunk.size());
+        chunkLength = (size_t)file.gcount();
+        chunkPos = 0;
+        consumed += chunkLength;
+        if (file.bad()) readFailed = true;
+        return chunkLength > 0;
+    }
+
+    // Opens (or reopens) the file at page 1
+    bool rewind() {
+        file.close();
+        file.clear();
+        file.open(path.c_str(), ios::binary);
+        if (!file.is_open()) return false;
+        file.seekg(0, ios::end);
+        fileSize = file.tellg();
+        file.seekg(0, ios::beg);
+        consumed = 0;
+        finished = false;
+        refill();
+        string_view head(chunk.data(), chunkLength);
+        isEncrypted = isEncryptedFile(head);
+        if (!isEncrypted && isLikelyEncrypted(head)) {
+            isEncrypted = ((long long)chunkLength == fileSize) ? isLegacyEncryptedFile(head) : hasLegacyChecksum();
+        }
+        escaped = startsWith(head, document_format_magic);
+        if (escaped) chunkPos = document_format_magic.length();
+        return !readFailed;
+    }
+
+    // Streams the whole file to test a legacy checksum trailer (last byte)
+    bool hasLegacyChecksum() {
+        ifstream whole(path.c_str(), ios::binary);
+        vector<char> buffer(export_buffer_size);
+        unsigned char sum = 0;
+        char last = 0;
+        long long length = 0;
+        while (whole.read(buffer.data(), buffer.size()) || whole.gcount() > 0) {
+            size_t count = (size_t)whole.gcount();
+            sum ^= xorBytes(buffer.data(), count);
+            last = buffer[count - 1];
+            length += count;
+        }
+        if (whole.bad() || length < 2) return false;
+        sum ^= (unsigned char)last; // The trailer is not part of its own checksum
+        return finishChecksum(sum, length - 1) == (unsigned char)last;
+    }
+
+    void appendPageBytes(const char* data, size_t length) {
+        const char* end = data + length;
+        while (data < end && !pageFull) {
+            const char* delimiter = (const char*)memchr(data, DELIMITER, end - data);
+            if (delimiter == nullptr) { pageBytes.append(data, end - data); return; }
+            if (++pageLines == MAX_LINES_PER_PAGE_STORAGE) {
+                pageBytes.append(data, delimiter - data);
+                pageFull = true;
+                return;
             }
+            pageBytes.append(data, delimiter - data + 1);
+            data = delimiter + 1;
+        }
+    }
+
+    const PageSlab* next() {
+        if (finished) return nullptr;
+        pageBytes.clear();
+        pageLines = 0;
+        pageFull = false;
+        while (true) {
+            if (chunkPos == chunkLength && !refill()) { finished = true; break; }
+            const char* start = chunk.data() + chunkPos;
+            size_t available = chunkLength - chunkPos;
+            const char* pageEnd = (const char*)memchr(start, PAGE_DELIMITER, available);
+            size_t length = (pageEnd != nullptr) ? (size_t)(pageEnd - start) : available;
+            appendPageBytes(start, length);
+            chunkPos += length;
+            if (pageEnd != nullptr) { chunkPos++; break; }
+        }
+        slab.clear();
+        parsePageSlab(&slab, pageBytes, escaped);
+        return &slab;
+    }
+};
+
+ExportSource makeFileSource(PageFileReader& reader) {
+    ExportSource source;
+    PageFileReader* r = &reader;
+    source.rewind = [r] { return r->rewind(); };
+    source.next = [r] { return r->next(); };
+    source.percentDone = [r] { return r->fileSize > 0 ? (int)(r->consumed * 100 / r->fileSize) : 100; };
+    return source;
+}
+
+/**
+ * Export Writers
+ */
+bool needsMarkdownEscape(char c) {
+    switch (c) {
+    case '\\': case '`': case '*': case '_': case '[': case ']': case '<': case '>':
+    case '|': case '#': case '~': case '&': return true;
+    default: return false;
+    }
+}
+
+// Writes text escaped for the format. Line breaks kept inside a line (see
+// needsEscape) become spaces, so they cannot break the page layout.
+void writeExportText(BufferedWriter& out, ExportFormat format, const char* text, size_t length) {
+    size_t runStart = 0;
+    for (size_t i = 0; i < length; ++i) {
+        char c = text[i];
+        if (c == DELIMITER || c == PAGE_DELIMITER) {
+            out.write(text + runStart, i - runStart);
+            out.put(' ');
+            runStart = i + 1;
+            continue;
+        }
+        if (format == EXPORT_TEXT) continue;
+        if (format == EXPORT_MARKDOWN) {
+            if (!needsMarkdownEscape(c)) continue;
+            out.write(text + runStart, i - runStart);
+            out.put('\\');
+            runStart = i; // The byte itself goes out with the next run
+            continue;
+        }
+        const char* entity = (c == '<') ? "&lt;" : (c == '>') ? "&gt;" : (c == '&') ? "&amp;" : (c == '"') ? "&quot;" : nullptr;
+        if (entity == nullptr) continue;
+        out.write(text + runStart, i - runStart);
+        out.write(entity);
+        runStart = i + 1;
+    }
+    out.write(text + runStart, length - runStart);
+}
+
+void writeExportText(BufferedWriter& out, ExportFormat format, const string& text) {
+    writeExportText(out, format, text.data(), text.length());
+}
+
+// Plain text cannot mark a match inside the line; its rows get a gutter marker instead
+void writeHighlightedLine(BufferedWriter& out, ExportFormat format, const string& line, const vector<size_t>& matches, size_t termLength) {
+    const char* open = (format == EXPORT_HTML) ? "<mark>" : (format == EXPORT_MARKDOWN) ? "**" : "";
+    const char* close = (format == EXPORT_HTML) ? "</mark>" : (format == EXPORT_MARKDOWN) ? "**" : "";
+    size_t lastPos = 0;
+    for (size_t m = 0; m < matches.size(); ++m) {
+        writeExportText(out, format, line.data() + lastPos, matches[m] - lastPos);
+        out.write(open);
+        writeExportText(out, format, line.data() + matches[m], termLength);
+        out.write(close);
+        lastPos = matches[m] + termLength;
+    }
+    writeExportText(out, format, line.data() + lastPos, line.length() - lastPos);
+}
+
+string getHeadingAnchor(int pageNumber, int storageLine) {
+    return "h-" + to_string(pageNumber) + "-" + to_string(storageLine);
+}
+
+void writeExportHeader(BufferedWriter& out, ExportFormat format, const string& title) {
+    if (format == EXPORT_HTML) {
+        out.write("<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>");
+        writeExportText(out, format, title);
+        out.write("</title>\n<style>\n"
+            "body { font-family: sans-serif; }\n"
+            ".page { border-top: 1px solid #999; margin: 2em 0; }\n"
+            ".columns { display: flex; gap: 3ch; }\n"
+            ".col { width: " + to_string(col_width) + "ch; margin: 0; font-family: monospace; white-space: pre; }\n"
+            ".heading { font-weight: bold; }\n"
+            "mark { background: #ff0; }\n"
+            "</style>\n</head>\n<body>\n<h1>");
+        writeExportText(out, format, title);
+        out.write("</h1>\n");
+    }
+    else if (format == EXPORT_MARKDOWN) {
+        out.write("# ");
+        writeExportText(out, format, title);
+        out.write("\n\n");
+    }
+    else {
+        writeExportText(out, format, title);
+        out.write("\n\n");
+    }
+}
+
+void writeTOCStart(BufferedWriter& out, ExportFormat format) {
+    if (format == EXPORT_HTML) out.write("<nav>\n<h2>Contents</h2>\n<ul>\n");
+    else if (format == EXPORT_MARKDOWN) out.write("## Contents\n\n");
+    else out.write("Contents\n");
+}
+
+void writeTOCEntry(BufferedWriter& out, ExportFormat format, int pageNumber, const HeadingEntry& heading) {
+    string anchor = getHeadingAnchor(pageNumber, heading.line);
+    string page = "page " + to_string(pageNumber);
+    size_t titleStart = heading.title.find_first_not_of(' ');
+    string title = (titleStart == string::npos) ? "" : heading.title.substr(titleStart);
+    if (format == EXPORT_HTML) {
+        out.write("<li style=\"margin-left: " + to_string((heading.level - 1) * 2) + "em\"><a href=\"#" + anchor + "\">");
+        writeExportText(out, format, title);
+        out.write("</a> (" + page + ")</li>\n");
+    }
+    else if (format == EXPORT_MARKDOWN) {
+        out.write(string((heading.level - 1) * 2, ' ') + "- [");
+        writeExportText(out, format, title);
+        out.write("](#" + anchor + ") (" + page + ")\n");
+    }
+    else {
+        out.write(string(heading.level * 2, ' '));
+        writeExportText(out, format, title);
+        out.write(" ... " + page + "\n");
+    }
+}
+
+void writeTOCEnd(BufferedWriter& out, ExportFormat format) {
+    if (format == EXPORT_HTML) out.write("</ul>\n</nav>\n");
+    else out.put('\n');
+}
+
+// One column line: heading lines carry their anchor
+void writeColumnLine(BufferedWriter& out, ExportFormat format, int pageNumber, const PageColumns& columns, int i,
+    const string& upperTerm, vector<size_t>& matches, string& upperLine) {
+    const string& line = columns.lines[i];
+    findHighlights(line, upperTerm, matches, upperLine);
+    bool heading = (line[0] == '#');
+    string anchor = heading ? getHeadingAnchor(pageNumber, columns.storageLine[i]) : "";
+    if (heading && format == EXPORT_HTML) out.write("<span class=\"heading\" id=\"" + anchor + "\">");
+    if (heading && format == EXPORT_MARKDOWN) out.write("<a id=\"" + anchor + "\"></a>");
+    writeHighlightedLine(out, format, line, matches, upperTerm.length());
+    if (heading && format == EXPORT_HTML) out.write("</span>");
+}
+
+// Column 1 holds entries [0, splitIndex), column 2 the rest. Unlike the
+// screen, rows past page_height are kept, so a long paragraph is never cut.
+void writeExportPage(BufferedWriter& out, ExportFormat format, int pageNumber, const PageColumns& columns, const string& upperTerm) {
+    int col1Lines = columns.splitIndex;
+    int col2Lines = columns.totalLines - columns.splitIndex;
+    int rows = max(col1Lines, col2Lines);
+    vector<size_t> matches;
+    string upperLine;
+
+    if (format == EXPORT_HTML) {
+        out.write("<section class=\"page\" id=\"page-" + to_string(pageNumber) + "\">\n<p>Page " + to_string(pageNumber) + "</p>\n<div class=\"columns\">\n");
+        for (int c = 0; c < 2; ++c) {
+            out.write("<pre class=\"col\">");
+            int first = (c == 0) ? 0 : columns.splitIndex;
+            int last = (c == 0) ? columns.splitIndex : columns.totalLines;
+            for (int i = first; i < last; ++i) {
+                if (i > first) out.put('\n');
+                writeColumnLine(out, format, pageNumber, columns, i, upperTerm, matches, upperLine);
+            }
+            out.write("</pre>\n");
+        }
+        out.write("</div>\n</section>\n");
+        return;
+    }
+
+    if (format == EXPORT_MARKDOWN) {
+        out.write("<a id=\"page-" + to_string(pageNumber) + "\"></a>\n\n| Page " + to_string(pageNumber) + " | |\n|---|---|\n");
+        for (int row = 0; row < rows; ++row) {
+            out.write("| ");
+            if (row < col1Lines) writeColumnLine(out, format, pageNumber, columns, row, upperTerm, matches, upperLine);
+            out.write(" | ");
+            if (row < col2Lines) writeColumnLine(out, format, pageNumber, columns, columns.splitIndex + row, upperTerm, matches, upperLine);
+            out.write(" |\n");
+        }
+        out.put('\n');
+        return;
+    }
+
+    // Plain text: the screen grid, with '*' in the gutter beside lines that hold a match
+    string pageTitle = "-- Page " + to_string(pageNumber) + " ";
+    out.write(pageTitle + string(max(0, page_end_X - (int)pageTitle.length()), '-') + "\n");
+    string row;
+    for (int r = 0; r < rows; ++r) {
+        row.clear();
+        for (int c = 0; c < 2; ++c) {
+            int lineCount = (c == 0) ? col1Lines : col2Lines;
+            if (r >= lineCount) continue;
+            const string& line = columns.lines[(c == 0) ? r : columns.splitIndex + r];
+            findHighlights(line, upperTerm, matches, upperLine);
+            int startX = (c == 0) ? col1_start_X : col2_start_X;
+            row.resize(max((int)row.length(), startX - 2), ' ');
+            row += matches.empty() ? ' ' : '*';
+            row += ' ';
+            row += line;
+        }
+        writeExportText(out, format, row);
+        out.put('\n');
+    }
+    out.put('\n');
+}
+
+void writeExportFooter(BufferedWriter& out, ExportFormat format) {
+    if (format == EXPORT_HTML) out.write("</body>\n</html>\n");
+}
+
+// Two passes over the source: contents, then pages. False if cancelled or on
+// a read/write error.
+bool exportPages(ExportSource& source, BufferedWriter& out, ExportFormat format, const string& title,
+    const string& highlight, BackgroundTask* task = nullptr) {
+    string upperTerm = toUpper(highlight);
+    writeExportHeader(out, format, title);
+
+    if (!source.rewind()) return false;
+    vector<HeadingEntry> headings;
+    bool hasContents = false;
+    int pageNumber = 0;
+    const PageSlab* slab;
+    while ((slab = source.next()) != nullptr) {
+        pageNumber++;
+        headings.clear();
+        collectSlabHeadings(slab, headings);
+        for (int h = 0; h < (int)headings.size(); ++h) {
+            if (!hasContents) { writeTOCStart(out, format); hasContents = true; }
+            writeTOCEntry(out, format, pageNumber, headings[h]);
+        }
+        if (task != nullptr && (pageNumber & 255) == 0) {
+            if (task->isCancelled()) return false;
+            task->report("contents", source.percentDone(), 100);
+        }
+    }
+    if (hasContents) writeTOCEnd(out, format);
+
+    if (!source.rewind()) return false;
+    PageColumns columns;
+    pageNumber = 0;
+    while ((slab = source.next()) != nullptr && !out.failed) {
+        pageNumber++;
+        PERF_SCOPE(PERF_EXPORT_PAGE, slab->text.length());
+        layoutPageColumns(slab, columns);
+        writeExportPage(out, format, pageNumber, columns, upperTerm);
+        if (task != nullptr && (pageNumber & 63) == 0) {
+            if (task->isCancelled()) break;
+            task->report("pages", source.percentDone(), 100);
+        }
+    }
+    if (task != nullptr && task->isCancelled()) return false;
+    writeExportFooter(out, format);
+    return !out.failed;
+}
+
+// Streams a saved document file to an export file without loading it
+// (used by --export). Encrypted files must be opened and decrypted first.
+bool exportFile(const string& inputPath, const string& outputPath, const string& highlight, string& error) {
+    if (inputPath == outputPath) { error = "The export would overwrite " + inputPath + "."; return false; }
+    PageFileReader reader(inputPath);
+    if (!reader.rewind()) { error = "Could not read " + inputPath + "."; return false; }
+    if (reader.isEncrypted) { error = inputPath + " is encrypted; open it in the editor to export it."; return false; }
+    BufferedWriter out(outputPath);
+    if (out.failed) { error = "Could not write " + outputPath + "."; return false; }
+    ExportSource source = makeFileSource(reader);
+    bool written = exportPages(source, out, getExportFormat(outputPath), inputPath, highlight);
+    if (!out.close() || !written || reader.readFailed) {
+        error = reader.readFailed ? "Could not read " + inputPath + "." : "Could not write " + outputPath + ".";
+        remove(outputPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Export runs in the background over a snapshot, like save. A cancelled or
+ * failed export removes the partial file.
+ */
+void exportDocumentToFile(string mainStatus) {
+    if (isTaskKindRunning(TASK_EXPORT)) {
+        updateMainStatusTemp("An export is already in progress.");
+        return;
+    }
+    if (activeDoc->isEncrypted) {
+        updateMainStatusTemp("Decrypt the document before exporting. Press any key.");
+        readKey();
+        updateMainStatus(mainStatus);
+        return;
+    }
+    updateMainStatusTemp("Export to (.txt/.md/.html): ");
+    string filename = getSimpleTextInput(30);
+    if (filename.empty()) { updateMainStatus(mainStatus); return; }
+    updateMainStatusTemp("Highlight term (Enter for none): ");
+    string highlight = getSimpleTextInput(35);
+
+    BackgroundTask* task = new BackgroundTask(TASK_EXPORT, "Exporting " + filename);
+    task->snapshot = snapshotDocument();
+    string title = activeDoc->name;
+    task->work = [filename, highlight, title](BackgroundTask& t) {
+        BufferedWriter out(filename);
+        if (out.failed) return;
+        ExportSource source = makeSnapshotSource(t.snapshot);
+        bool written = exportPages(source, out, getExportFormat(filename), title, highlight, &t);
+        t.succeeded = out.close() && written;
+        if (!t.succeeded) remove(filename.c_str());
+    };
+    task->complete = [filename](BackgroundTask& t) {
+        if (t.isCancelled()) t.message = "Export cancelled. " + filename + " was not written.";
+        else if (!t.succeeded) t.message = "Could not write " + filename + ".";
+        else t.message = "Exported to " + filename + ".";
+    };
+    startBackgroundTask(task);
+}
+
+/**
+ * Table of Contents (TOC) Generator
+ */
+// Prints one screen of entries starting at index first; returns how many were shown
+int drawTOCEntries(int first, int tocCount, int y) {
+    PERF_SCOPE(PERF_TOC_VIEW, 0);
+    // Only the entries on this screen are located and printed
+    int shown = 0;
+    while (shown < toc_entries_per_screen && first + shown < tocCount) {
+        int slot = 0;
+        DocumentPage* page = locateHeading(first + shown, slot);
+        if (page == nullptr) break;
+        for (; slot < (int)page->headings.size() && shown < toc_entries_per_screen; ++slot, ++shown) {
+            const HeadingEntry& entry = page->headings[slot];
+            gotoxy(3, y + shown);
+            string indent((entry.level - 1) * 2, ' ');
+            string title = indent + to_string(first + shown + 1) + ". " + entry.title;
+            if (title.length() > 40) title = title.substr(0, 37) + "...";
+            string location = "Page " + to_string(page->pageIndex + 1) + ", Col " + to_string((entry.line < page_height) ? 1 : 2);
+            cout << title;
+            int dots = (page_end_X - 5) - title.length() - location.length();
+            if (dots > 0) cout << string(dots, '.');
+            cout << location;
         }
-        current = current->next;
     }
+    return shown;
+}
 
+// Returns true when the user picked an entry; currentPagePtr then points at its page
+bool handleTOCView(int currentPage, string mainStatus) {
+    int tocCount = getHeadingTotal();
+    int totalScreens = (tocCount + toc_entries_per_screen - 1) / toc_entries_per_screen;
+    int screen = 0;
     int y = 3;
-    for (int i = 0; i < tocCount; ++i) {
+    string entryNumber = "";
+    DocumentPage* target = nullptr;
+
+    while (true) {
+        clearScreen();
+        gotoxy(3, 1);
+        cout << "--- TABLE OF CONTENTS ---";
+        if (totalScreens > 1) cout << "  (" << (screen + 1) << "/" << totalScreens << ")";
+
+        int shown = drawTOCEntries(screen * toc_entries_per_screen, tocCount, y);
+        if (tocCount == 0) {
+            gotoxy(3, y);
+            cout << "No headings found. (Start a line with # to create one.)";
+            shown = 1;
+        }
+
+        gotoxy(3, y + shown + 1);
+        if (tocCount > 0) cout << "Type entry number + [Enter] to jump | ";
+        if (totalScreens > 1) cout << "[N/P] More | ";
+        cout << "Any other key returns";
+        gotoxy(3, y + shown + 2);
+        cout << "Go to: " << entryNumber;
+
+        char key = readKey();
+        if (key >= '0' && key <= '9' && tocCount > 0) { entryNumber += key; continue; }
+        if (key == 8) { if (!entryNumber.empty()) entryNumber.erase(entryNumber.length() - 1); continue; }
+        if (key == 13) {
+            int entry = parsePositiveNumber(entryNumber);
+            entryNumber = "";
+            int slot = 0;
+            if (entry > 0 && entry <= tocCount) target = locateHeading(entry - 1, slot);
+            if (target != nullptr) break;
+            continue;
+        }
+        if ((key == 'n' || key == 'N') && screen < totalScreens - 1) screen++;
+        else if ((key == 'p' || key == 'P') && screen > 0) screen--;
+        else if (key != 'n' && key != 'N' && key != 'p' && key != 'P') break;
+    }
+
+    if (target != nullptr) {
+        activeDoc->currentPagePtr = target;
+        return true;
+    }
+
+    drawEditorUI(currentPage);
+    displayPageContent(currentPage);
+    updateMainStatus(mainStatus);
+    return false;
+}
+
+/**
+ * Jump-to-Page Prompt
+ * Takes a page number, or W and a word number for the page holding that
+ * word. Returns true when currentPagePtr was moved to the requested page.
+ */
+bool handleGotoPage(string mainStatus) {
+    string prompt = "Go to page (1-" + to_string(getPageCount()) + ", or W and a word number): ";
+    updateMainStatusTemp(prompt);
+    string typed = getSimpleTextInput(col1_start_X + prompt.length());
+    bool byWord = !typed.empty() && (typed[0] == 'w' || typed[0] == 'W');
+    DocumentPage* target = byWord ? findPageOfWord(parsePositiveNumber(typed.substr(1))) : getPageByNumber(parsePositiveNumber(typed));
+    if (target == nullptr) {
+        if (!typed.empty()) {
+            updateMainStatusTemp(byWord ? "No such word. Press any key." : "No such page. Press any key.");
+            readKey();
+        }
+        updateMainStatus(mainStatus);
+        return false;
+    }
+    activeDoc->currentPagePtr = target;
+    return true;
+}
+
+/**
+ * Performance Stats Screen
+ * Per-metric latency (p50/p99 over recent calls), bytes and allocations,
+ * with toggles for profiling and a trace export.
+ */
+string formatDuration(long long ns) {
+    char buffer[32];
+    if (ns < 1000) snprintf(buffer, sizeof(buffer), "%lldns", ns);
+    else if (ns < 1000000) snprintf(buffer, sizeof(buffer), "%.1fus", ns / 1000.0);
+    else snprintf(buffer, sizeof(buffer), "%.2fms", ns / 1000000.0);
+    return buffer;
+}
+
+string formatBytes(long long bytes) {
+    char buffer[32];
+    if (bytes < 1024) snprintf(buffer, sizeof(buffer), "%lldB", bytes);
+    else if (bytes < 1024 * 1024) snprintf(buffer, sizeof(buffer), "%.1fK", bytes / 1024.0);
+    else snprintf(buffer, sizeof(buffer), "%.1fM", bytes / (1024.0 * 1024.0));
+    return buffer;
+}
+
+void handlePerfStatsView(int currentPage, string mainStatus) {
+    string notice = "";
+    while (true) {
+        clearScreen();
+        gotoxy(3, 1);
+        cout << "--- PERFORMANCE STATS --- Profiling: " << (perfEnabled.load() ? "ON" : "OFF");
+        gotoxy(3, 3);
+        char row[160];
+        snprintf(row, sizeof(row), "%-20s %8s %9s %9s %9s %8s %8s", "Metric", "Calls", "p50", "p99", "Max", "Bytes", "Allocs");
+        cout << row;
+        for (int m = 0; m < PERF_METRIC_COUNT; ++m) {
+            PerfStats& stats = perfStats[m];
+            long long calls = stats.calls.load();
+            gotoxy(3, 4 + m);
+            if (calls == 0) {
+                snprintf(row, sizeof(row), "%-20s %8s", perfMetricNames[m], "-");
+                cout << row;
+                continue;
+            }
+            snprintf(row, sizeof(row), "%-20s %8lld %9s %9s %9s %8s %8lld", perfMetricNames[m], calls,
+                formatDuration(getPerfPercentile(m, 50)).c_str(), formatDuration(getPerfPercentile(m, 99)).c_str(),
+                formatDuration(stats.maxNs.load()).c_str(), formatBytes(stats.bytes.load()).c_str(), stats.allocations.load() / calls);
+            cout << row;
+        }
+        gotoxy(3, 5 + PERF_METRIC_COUNT);
+        cout << "(Allocs = average allocations per call)";
+        gotoxy(3, 7 + PERF_METRIC_COUNT);
+        cout << "[P] Toggle profiling | [C] Clear | [X] Export trace | Any other key returns";
+        if (!notice.empty()) {
+            gotoxy(3, 9 + PERF_METRIC_COUNT);
+            cout << notice;
+        }
+
+        char key = readKey();
+        if (key == 'p' || key == 'P') { perfEnabled.store(!perfEnabled.load()); notice = ""; }
+        else if (key == 'c' || key == 'C') { resetPerfStats(); notice = "Stats cleared."; }
+        else if (key == 'x' || key == 'X') {
+            gotoxy(3, 9 + PERF_METRIC_COUNT);
+            cout << string(60, ' ');
+            gotoxy(3, 9 + PERF_METRIC_COUNT);
+            cout << "Trace file: ";
+            showCursor();
+            string filename = "";
+            char c;
+            while ((c = readKey()) != 13) {
+                if (c == 8) { if (!filename.empty()) { filename.erase(filename.length() - 1); cout << "\b \b"; } }
+                else { filename += c; cout << c; }
+            }
+            hideCursor();
+            if (filename.empty()) filename = "doceditor_trace.json";
+            notice = exportPerfTrace(filename) ? "Trace written to " + filename : "Could not write " + filename;
+        }
+        else break;
+    }
+
+    drawEditorUI(currentPage);
+    displayPageContent(currentPage);
+    updateMainStatus(mainStatus);
+}
+
+/**
+ * Open Documents Screen
+ * Lists the session's documents with their state and memory, and switches,
+ * creates or closes documents. Returns true when the active document changed.
+ */
+void drawDocumentList(int y) {
+    for (int i = 0; i < (int)sessionDocuments.size(); ++i) {
+        Document* doc = sessionDocuments[i];
+        string name = doc->name;
+        if (name.length() > 28) name = name.substr(0, 25) + "...";
+        string state = doc->isEvicted ? "on disk" : to_string(doc->pageTable.size()) + " pages";
+        if (doc->isEncrypted) state += ", encrypted";
+        char row[160];
+        snprintf(row, sizeof(row), "%2d. %c %-28s %-22s %10s", i + 1, (doc == activeDoc) ? '*' : ' ', name.c_str(),
+            state.c_str(), doc->isEvicted ? "-" : formatBytes(estimateDocumentMemory(doc)).c_str());
         gotoxy(3, y + i);
-        string title = to_string(i + 1) + ". " + titles[i];
-        if (title.length() > 40) title = title.substr(0, 37) + "...";
-        string location = "Page " + to_string(pages[i]) + ", Col " + to_string(cols[i]);
-        cout << title;
-        int dots = (page_end_X - 5) - title.length() - location.length();
-        if (dots > 0) cout << string(dots, '.');
-        cout << location;
-    }
-    if (tocCount == 0) {
+        cout << row;
+    }
+}
+
+bool handleDocumentListView(int currentPage, string mainStatus) {
+    string entryNumber = "";
+    string notice = "";
+    bool changed = false;
+    while (true) {
+        clearScreen();
+        gotoxy(3, 1);
+        cout << "--- OPEN DOCUMENTS ---  Memory: " << formatBytes(estimateSessionMemory());
+        if (sessionMemoryLimit > 0) cout << " of " << formatBytes(sessionMemoryLimit);
+        int y = 3;
+        drawDocumentList(y);
+        y += (int)sessionDocuments.size() + 1;
         gotoxy(3, y);
-        cout << "No headings found. (Start a line with # to create one.)";
+        cout << "Type number + [Enter] to switch | [N] New | [X] Close current | Any other key returns";
+        gotoxy(3, y + 1);
+        cout << "Switch to: " << entryNumber;
+        if (!notice.empty()) { gotoxy(3, y + 3); cout << notice; notice = ""; }
+
+        char key = readKey();
+        if (key >= '0' && key <= '9') { entryNumber += key; continue; }
+        if (key == 8) { if (!entryNumber.empty()) entryNumber.erase(entryNumber.length() - 1); continue; }
+        if (key == 13) {
+            int number = parsePositiveNumber(entryNumber);
+            entryNumber = "";
+            if (number < 1 || number > (int)sessionDocuments.size()) continue;
+            if (!switchToDocument(sessionDocuments[number - 1])) { notice = "Could not read the document back from disk."; continue; }
+            changed = true;
+            break;
+        }
+        if (key == 'n' || key == 'N') { createDocument(); changed = true; break; }
+        if (key == 'x' || key == 'X') {
+            if (sessionDocuments.size() < 2) notice = "The last open document cannot be closed.";
+            else if (documentHasTasks(activeDoc)) notice = "Wait for this document's background work to finish.";
+            else if (closeDocument(activeDoc)) changed = true;
+            continue;
+        }
+        break;
+    }
+
+    if (changed) return true;
+    drawEditorUI(currentPage);
+    displayPageContent(currentPage);
+    updateMainStatus(mainStatus);
+    return false;
+}
+
+/**
+ * Document Compare
+ * Two documents are aligned page by page on their content hashes, so pages
+ * that did not change are never read. Only the pages that differ are split
+ * into lines and aligned the same way, giving the rows of the compare view.
+ * Alignment is Myers' diff over the hash sequences after the common prefix
+ * and suffix are trimmed, so a few edits cost little more than one pass.
+ */
+const int compare_max_page_edits = 1024; // Beyond this, unmatched pages are paired by position
+
+enum DiffRowKind { DIFF_SAME, DIFF_CHANGED, DIFF_DELETED, DIFF_INSERTED };
+
+struct DiffRow {
+    DiffRowKind kind;
+    int oldLine; // Slab lines; -1 on the side that has none
+    int newLine;
+};
+
+struct PageDiff {
+    int oldPage;     // Snapshot indexes; -1 for an inserted or deleted page
+    int newPage;
+    int newPosition; // New page at this point of the document (G jumps there)
+    vector<DiffRow> rows;
+};
+
+struct DocumentComparison {
+    vector<PageSlab*> oldPages; // Snapshots, released by releaseComparison()
+    vector<PageSlab*> newPages;
+    vector<PageDiff> changes;   // Pages that differ, in document order
+    int unchangedPages;
+    int changedPages;
+    int insertedPages;
+    int deletedPages;
+    long long elapsedNs;
+
+    DocumentComparison() : unchangedPages(0), changedPages(0), insertedPages(0), deletedPages(0), elapsedNs(0) {}
+};
+
+// Appends the matches of a[0..n) and b[0..m), shifted by the offsets; false
+// if they need more than maxEdits insertions and deletions
+bool appendMyersMatches(const unsigned long long* a, int n, const unsigned long long* b, int m, int maxEdits,
+    int aOffset, int bOffset, vector<pair<int, int>>& matches) {
+    int limit = min(n + m, maxEdits);
+    int offset = limit + 1;
+    vector<int> furthest(2 * limit + 3, 0); // Furthest x reached on each diagonal k = x - y
+    vector<int> trace;                       // furthest[-d..d] after each round d, from index d * d
+    int edits = -1;
+    for (int d = 0; d <= limit && edits < 0; ++d) {
+        for (int k = -d; k <= d; k += 2) {
+            bool down = (k == -d || (k != d && furthest[offset + k - 1] < furthest[offset + k + 1]));
+            int x = down ? furthest[offset + k + 1] : furthest[offset + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y]) { x++; y++; }
+            furthest[offset + k] = x;
+            if (k == n - m && x >= n) edits = d;
+        }
+        trace.insert(trace.end(), furthest.begin() + (offset - d), furthest.begin() + (offset + d + 1));
+    }
+    if (edits < 0) return false;
+
+    // Walk back from the end, taking each round's snake
+    size_t first = matches.size();
+    int x = n, y = m;
+    for (int d = edits; d > 0; --d) {
+        const int* previous = &trace[(size_t)(d - 1) * (d - 1)] + (d - 1); // Indexed by k
+        int k = x - y;
+        bool down = (k == -d || (k != d && previous[k - 1] < previous[k + 1]));
+        int previousK = down ? k + 1 : k - 1;
+        int previousX = previous[previousK];
+        int snakeStart = down ? previousX : previousX + 1;
+        while (x > snakeStart) { x--; y--; matches.push_back(make_pair(aOffset + x, bOffset + y)); }
+        x = previousX;
+        y = previousX - previousK;
+    }
+    while (x > 0) { x--; y--; matches.push_back(make_pair(aOffset + x, bOffset + y)); }
+    reverse(matches.begin() + first, matches.end());
+    return true;
+}
+
+// Longest common subsequence of a and b as increasing index pairs. Returns
+// false, with only the common prefix and suffix matched, when the rest would
+// need more than maxEdits insertions and deletions.
+bool alignSequences(const vector<unsigned long long>& a, const vector<unsigned long long>& b, int maxEdits, vector<pair<int, int>>& matches) {
+    matches.clear();
+    int n = (int)a.size(), m = (int)b.size();
+    int prefix = 0;
+    while (prefix < n && prefix < m && a[prefix] == b[prefix]) prefix++;
+    int suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix && a[n - 1 - suffix] == b[m - 1 - suffix]) suffix++;
+
+    for (int i = 0; i < prefix; ++i) matches.push_back(make_pair(i, i));
+    bool aligned = true;
+    int middleA = n - prefix - suffix, middleB = m - prefix - suffix;
+    if (middleA > 0 && middleB > 0) {
+        aligned = appendMyersMatches(a.data() + prefix, middleA, b.data() + prefix, middleB, maxEdits, prefix, prefix, matches);
+    }
+    for (int i = 0; i < suffix; ++i) matches.push_back(make_pair(n - suffix + i, m - suffix + i));
+    return aligned;
+}
+
+// A page's non-empty lines (what the columns show) with their hashes
+void collectLineHashes(const PageSlab* slab, vector<int>& lines, vector<unsigned long long>& hashes) {
+    lines.clear();
+    hashes.clear();
+    if (slab == nullptr) return;
+    for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) {
+        int length = slab->lineLength(l);
+        if (length == 0) continue;
+        lines.push_back(l);
+        hashes.push_back(hashBytes(slab->text.data() + slab->lineStart(l), length, 0));
+    }
+}
+
+// Lines left between two matches are paired up as changed rows; the rest
+// of the longer side become deleted or inserted rows
+void diffPageLines(const PageSlab* oldSlab, const PageSlab* newSlab, PageDiff& diff) {
+    vector<int> oldLines, newLines;
+    vector<unsigned long long> oldHashes, newHashes;
+    collectLineHashes(oldSlab, oldLines, oldHashes);
+    collectLineHashes(newSlab, newLines, newHashes);
+    vector<pair<int, int>> matches;
+    alignSequences(oldHashes, newHashes, (int)(oldHashes.size() + newHashes.size()), matches);
+    matches.push_back(make_pair((int)oldLines.size(), (int)newLines.size())); // End marker
+
+    int i = 0, j = 0;
+    for (size_t s = 0; s < matches.size(); ++s) {
+        for (; i < matches[s].first && j < matches[s].second; ++i, ++j) diff.rows.push_back(DiffRow{ DIFF_CHANGED, oldLines[i], newLines[j] });
+        for (; i < matches[s].first; ++i) diff.rows.push_back(DiffRow{ DIFF_DELETED, oldLines[i], -1 });
+        for (; j < matches[s].second; ++j) diff.rows.push_back(DiffRow{ DIFF_INSERTED, -1, newLines[j] });
+        if (s + 1 < matches.size()) { diff.rows.push_back(DiffRow{ DIFF_SAME, oldLines[i], newLines[j] }); i++; j++; }
+    }
+}
+
+void addPageDiff(DocumentComparison& result, int oldPage, int newPage, int newPosition) {
+    result.changes.push_back(PageDiff());
+    PageDiff& diff = result.changes.back();
+    diff.oldPage = oldPage;
+    diff.newPage = newPage;
+    diff.newPosition = newPosition;
+    diffPageLines(oldPage < 0 ? nullptr : result.oldPages[oldPage], newPage < 0 ? nullptr : result.newPages[newPage], diff);
+}
+
+// Pages left between two matches are paired up as changed pages, the same
+// way lines are. Reads only the snapshots, so worker-safe.
+void compareSnapshots(const vector<unsigned long long>& oldHashes, const vector<unsigned long long>& newHashes, DocumentComparison& result) {
+    vector<pair<int, int>> matches;
+    alignSequences(oldHashes, newHashes, compare_max_page_edits, matches);
+    matches.push_back(make_pair((int)oldHashes.size(), (int)newHashes.size())); // End marker
+
+    int i = 0, j = 0;
+    for (size_t s = 0; s < matches.size(); ++s) {
+        for (; i < matches[s].first && j < matches[s].second; ++i, ++j) { addPageDiff(result, i, j, j); result.changedPages++; }
+        for (; i < matches[s].first; ++i) { addPageDiff(result, i, -1, j); result.deletedPages++; }
+        for (; j < matches[s].second; ++j) { addPageDiff(result, -1, j, j); result.insertedPages++; }
+        if (s + 1 < matches.size()) { result.unchangedPages++; i++; j++; }
+    }
+}
+
+// Both documents must be in memory; the result keeps snapshots of their pages
+void compareDocuments(Document* oldDoc, Document* newDoc, DocumentComparison& result) {
+    PERF_SCOPE(PERF_COMPARE, 0);
+    long long startNs = perfNowNs();
+    vector<unsigned long long> oldHashes, newHashes;
+    {
+        ActiveDocumentScope scope(oldDoc);
+        result.oldPages = snapshotDocument();
+        for (int i = 0; i < (int)activeDoc->pageTable.size(); ++i) oldHashes.push_back(activeDoc->pageTable[i]->contentHash);
+    }
+    {
+        ActiveDocumentScope scope(newDoc);
+        result.newPages = snapshotDocument();
+        for (int i = 0; i < (int)activeDoc->pageTable.size(); ++i) newHashes.push_back(activeDoc->pageTable[i]->contentHash);
+    }
+    compareSnapshots(oldHashes, newHashes, result);
+    result.elapsedNs = perfNowNs() - startNs;
+}
+
+void releaseComparison(DocumentComparison& result) {
+    for (int i = 0; i < (int)result.oldPages.size(); ++i) releaseSlab(result.oldPages[i]);
+    for (int i = 0; i < (int)result.newPages.size(); ++i) releaseSlab(result.newPages[i]);
+    result.oldPages.clear();
+    result.newPages.clear();
+    result.changes.clear();
+}
+
+/**
+ * Compare View
+ * The other document fills column 1 and the current one column 2, one line
+ * pair per row. Changed text is highlighted and marked - and + beside the
+ * columns. N / P step through the changes a screen at a time.
+ */
+string_view getSlabLine(const PageSlab* slab, int line) {
+    return string_view(slab->text).substr(slab->lineStart(line), slab->lineLength(line));
+}
+
+// Draws the part of a line that fits the column, highlighting [from, to)
+void drawDiffCell(int x, int y, string_view text, size_t from, size_t to) {
+    if (text.length() > (size_t)col_width) text = text.substr(0, col_width);
+    from = min(from, text.length());
+    to = min(max(to, from), text.length());
+    gotoxy(x, y);
+    cout << text.substr(0, from);
+    if (to > from) {
+        setHighlightColor();
+        cout << text.substr(from, to - from);
+        resetTextColor();
+    }
+    cout << text.substr(to);
+}
+
+// A changed row highlights what lies between the common prefix and suffix
+void drawDiffRow(const DocumentComparison& comparison, const PageDiff& diff, const DiffRow& row, int y) {
+    string_view oldText = (row.oldLine < 0) ? string_view() : getSlabLine(comparison.oldPages[diff.oldPage], row.oldLine);
+    string_view newText = (row.newLine < 0) ? string_view() : getSlabLine(comparison.newPages[diff.newPage], row.newLine);
+    size_t oldFrom = 0, oldTo = 0, newFrom = 0, newTo = 0;
+    if (row.kind == DIFF_CHANGED) {
+        size_t shorter = min(oldText.length(), newText.length());
+        size_t prefix = 0;
+        while (prefix < shorter && oldText[prefix] == newText[prefix]) prefix++;
+        size_t suffix = 0;
+        while (suffix < shorter - prefix && oldText[oldText.length() - 1 - suffix] == newText[newText.length() - 1 - suffix]) suffix++;
+        oldFrom = newFrom = prefix;
+        oldTo = oldText.length() - suffix;
+        newTo = newText.length() - suffix;
+    }
+    else if (row.kind == DIFF_DELETED) oldTo = oldText.length();
+    else if (row.kind == DIFF_INSERTED) newTo = newText.length();
+
+    drawDiffCell(col1_start_X, y, oldText, oldFrom, oldTo);
+    drawDiffCell(col2_start_X, y, newText, newFrom, newTo);
+    if (row.kind == DIFF_CHANGED || row.kind == DIFF_DELETED) { gotoxy(col1_start_X - 1, y); cout << '-'; }
+    if (row.kind == DIFF_CHANGED || row.kind == DIFF_INSERTED) { gotoxy(col2_start_X - 1, y); cout << '+'; }
+}
+
+string getDiffPageLabel(int page, bool inserted) {
+    if (page >= 0) return "--- Page " + to_string(page + 1) + " ---";
+    return inserted ? "--- (inserted) ---" : "--- (deleted) ---";
+}
+
+void drawComparisonScreen(const DocumentComparison& comparison, const string& oldName, int change, int firstRow) {
+    clearScreen();
+    string newName = activeDoc->name;
+    gotoxy(col1_start_X, 0);
+    cout << "Old: " << oldName.substr(0, col_width - 5);
+    gotoxy(col2_start_X, 0);
+    cout << "New: " << newName.substr(0, col_width - 5);
+    for (int y = page_start_Y; y < page_start_Y + page_height; ++y) {
+        gotoxy(col1_start_X - 2, y);
+        cout << "|";
+        gotoxy(col2_start_X - 2, y);
+        cout << "|";
+        gotoxy(col2_start_X + col_width, y);
+        cout << "|";
+    }
+
+    int totalPages = comparison.unchangedPages + comparison.changedPages + comparison.deletedPages;
+    string summary = "Pages: " + to_string(comparison.changedPages) + " changed, " + to_string(comparison.insertedPages) +
+        " inserted, " + to_string(comparison.deletedPages) + " deleted, " + to_string(comparison.unchangedPages) +
+        " unchanged (" + formatDuration(comparison.elapsedNs) + ")";
+    gotoxy(col1_start_X, STATS_BAR_Y);
+    cout << summary;
+
+    if (comparison.changes.empty()) {
+        gotoxy(col1_start_X, page_start_Y);
+        cout << "The documents are identical (" << totalPages << " pages).";
+        gotoxy(col1_start_X, STATUS_BAR_Y);
+        cout << "Any key returns";
+        return;
     }
 
-    gotoxy(3, y + tocCount + 2);
-    cout << "Press any key to return to editor";
-    _getch();
+    const PageDiff& diff = comparison.changes[change];
+    gotoxy(col1_start_X, page_start_Y - 1);
+    cout << getDiffPageLabel(diff.oldPage, true);
+    gotoxy(col2_start_X, page_start_Y - 1);
+    cout << getDiffPageLabel(diff.newPage, false);
+    int shown = min(page_height, (int)diff.rows.size() - firstRow);
+    for (int r = 0; r < shown; ++r) drawDiffRow(comparison, diff, diff.rows[firstRow + r], page_start_Y + r);
+
+    gotoxy(col1_start_X, STATUS_BAR_Y);
+    cout << "Change " << (change + 1) << "/" << comparison.changes.size();
+    if ((int)diff.rows.size() > page_height) cout << " (rows " << (firstRow + 1) << "-" << (firstRow + shown) << " of " << diff.rows.size() << ")";
+    cout << " | [N/P] Next/Prev | [G] Go to page | Any other key returns";
+}
 
+// Lets the user page through the changes; returns the page picked with G, if any
+DocumentPage* showComparison(const DocumentComparison& comparison, const string& oldName) {
+    int change = 0, firstRow = 0;
+    while (true) {
+        drawComparisonScreen(comparison, oldName, change, firstRow);
+        char key = readKey();
+        if (comparison.changes.empty()) return nullptr;
+        const PageDiff& diff = comparison.changes[change];
+        if (key == 'n' || key == 'N') {
+            if (firstRow + page_height < (int)diff.rows.size()) firstRow += page_height;
+            else if (change + 1 < (int)comparison.changes.size()) { change++; firstRow = 0; }
+        }
+        else if (key == 'p' || key == 'P') {
+            if (firstRow > 0) firstRow -= page_height;
+            else if (change > 0) {
+                change--;
+                int rows = (int)comparison.changes[change].rows.size();
+                firstRow = (rows > 0) ? ((rows - 1) / page_height) * page_height : 0;
+            }
+        }
+        else if (key == 'g' || key == 'G') {
+            int last = (int)activeDoc->pageTable.size() - 1;
+            return activeDoc->pageTable[min(diff.newPosition, last)];
+        }
+        else return nullptr;
+    }
+}
+
+// Compares the current document with another open one (the older version).
+// Returns true when the user jumped to a changed page.
+bool handleCompareView(int currentPage, string mainStatus) {
+    if (sessionDocuments.size() < 2) {
+        updateMainStatusTemp("Open the other version first ([O] Open or [D] Documents). Press any key.");
+        readKey();
+        updateMainStatus(mainStatus);
+        return false;
+    }
+
+    string entryNumber = "";
+    string notice = "";
+    Document* other = nullptr;
+    while (true) {
+        clearScreen();
+        gotoxy(3, 1);
+        cout << "--- COMPARE DOCUMENTS ---";
+        int y = 3;
+        drawDocumentList(y);
+        y += (int)sessionDocuments.size() + 1;
+        gotoxy(3, y);
+        cout << "Type the number of the older version + [Enter] | Any other key returns";
+        gotoxy(3, y + 1);
+        cout << "Compare with: " << entryNumber;
+        if (!notice.empty()) { gotoxy(3, y + 3); cout << notice; notice = ""; }
+
+        char key = readKey();
+        if (key >= '0' && key <= '9') { entryNumber += key; continue; }
+        if (key == 8) { if (!entryNumber.empty()) entryNumber.erase(entryNumber.length() - 1); continue; }
+        if (key != 13) break;
+        int number = parsePositiveNumber(entryNumber);
+        entryNumber = "";
+        if (number < 1 || number > (int)sessionDocuments.size()) continue;
+        Document* doc = sessionDocuments[number - 1];
+        if (doc == activeDoc) notice = "Pick a document other than the current one.";
+        else if (doc->isEncrypted || activeDoc->isEncrypted) notice = "Decrypt both documents before comparing them.";
+        else if (documentHasTasks(doc) || documentHasTasks(activeDoc)) notice = "Wait for background work on them to finish.";
+        else if (!restoreDocument(doc)) notice = "Could not read the document back from disk.";
+        else { other = doc; break; }
+    }
+
+    DocumentPage* target = nullptr;
+    if (other != nullptr) {
+        DocumentComparison comparison;
+        compareDocuments(other, activeDoc, comparison);
+        target = showComparison(comparison, other->name);
+        releaseComparison(comparison);
+        enforceSessionMemoryLimit();
+    }
+    if (target != nullptr) {
+        activeDoc->currentPagePtr = target;
+        return true;
+    }
     drawEditorUI(currentPage);
     displayPageContent(currentPage);
     updateMainStatus(mainStatus);
+    return false;
+}
+
+/**
+ * Replay Report
+ * Per-key latency of a replayed script plus a hash of the final document,
+ * so two runs of the same script can be checked for identical results.
+ */
+double getReplayPercentileUs(const vector<long long>& sorted, double percentile) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)((sorted.size() - 1) * percentile / 100.0);
+    return sorted[rank] / 1000.0;
+}
+
+// A key as the body of a JSON string (Esc and other bytes become \u escapes)
+string describeKey(unsigned char key) {
+    if (key == 13) return "\\r";
+    if (key == 8) return "\\b";
+    if (key == '"' || key == '\\') return string("\\") + (char)key;
+    if (key >= 32 && key < 127) return string(1, (char)key);
+    char buffer[8];
+    snprintf(buffer, sizeof(buffer), "\\u%04x", key);
+    return buffer;
+}
+
+// Prints the summary and, when jsonPath is set, writes it as JSON
+void printReplayReport(const string& jsonPath) {
+    vector<long long> sorted = replayLatencyNs;
+    sort(sorted.begin(), sorted.end());
+    long long totalNs = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) totalNs += sorted[i];
+    double totalMs = totalNs / 1000000.0;
+    double meanUs = sorted.empty() ? 0 : totalNs / 1000.0 / sorted.size();
+    char hash[32];
+    snprintf(hash, sizeof(hash), "%016llx", hashText(serializeDocument()));
+
+    // The slowest keys, by position in the script
+    vector<int> slowest;
+    for (int i = 0; i < (int)replayLatencyNs.size(); ++i) slowest.push_back(i);
+    int slowCount = min((int)slowest.size(), 5);
+    partial_sort(slowest.begin(), slowest.begin() + slowCount, slowest.end(),
+        [](int a, int b) { return replayLatencyNs[a] > replayLatencyNs[b]; });
+
+    char line[256];
+    snprintf(line, sizeof(line), "Replayed %zu keys in %.1f ms (%.0f keys/s)\n", sorted.size(), totalMs,
+        totalMs > 0 ? sorted.size() / (totalMs / 1000.0) : 0.0);
+    cout << line;
+    snprintf(line, sizeof(line), "Latency us: mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", meanUs,
+        getReplayPercentileUs(sorted, 50), getReplayPercentileUs(sorted, 90), getReplayPercentileUs(sorted, 99),
+        getReplayPercentileUs(sorted, 99.9), getReplayPercentileUs(sorted, 100));
+    cout << line;
+    cout << "Pages: " << getPageCount() << "  Document hash: " << hash << "\n";
+
+    if (jsonPath.empty()) return;
+    string json = "{\n  \"keys\": " + to_string(sorted.size());
+    snprintf(line, sizeof(line), ",\n  \"total_ms\": %.3f,\n  \"mean_us\": %.3f,\n  \"p50_us\": %.3f,\n  \"p90_us\": %.3f,"
+        "\n  \"p99_us\": %.3f,\n  \"p999_us\": %.3f,\n  \"max_us\": %.3f", totalMs, meanUs,
+        getReplayPercentileUs(sorted, 50), getReplayPercentileUs(sorted, 90), getReplayPercentileUs(sorted, 99),
+        getReplayPercentileUs(sorted, 99.9), getReplayPercentileUs(sorted, 100));
+    json += line;
+    json += ",\n  \"pages\": " + to_string(getPageCount()) + ",\n  \"document_hash\": \"" + hash + "\",\n  \"slowest\": [";
+    for (int i = 0; i < slowCount; ++i) {
+        int index = slowest[i];
+        snprintf(line, sizeof(line), "%s\n    {\"index\": %d, \"key\": \"%s\", \"us\": %.3f}", (i > 0) ? "," : "",
+            index, describeKey(replayKeys[index]).c_str(), replayLatencyNs[index] / 1000.0);
+        json += line;
+    }
+    json += "\n  ]\n}\n";
+    if (!writeFile(jsonPath, json)) cout << "Could not write " << jsonPath << "\n";
 }
\ No newline at end of file
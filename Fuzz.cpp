@@ -0,0 +1,376 @@
+﻿#define DOCEDITOR_NO_PERF // Probes are not needed here; no allocation hook either, so sanitizer allocators stay in place
+#include "DocEditor.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+/**
+ * Serializer and Cipher Property Tests
+ * Every property takes arbitrary bytes, so the same code runs under
+ * libFuzzer (build with -DDOCEDITOR_LIBFUZZER -fsanitize=fuzzer) or as the
+ * standalone random tester in main() below.
+ */
+struct FuzzInput {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+
+    FuzzInput(const uint8_t* bytes, size_t length) : data(bytes), size(length), pos(0) {}
+
+    uint8_t byte() { return (pos < size) ? data[pos++] : 0; }
+
+    string bytes(size_t count) {
+        count = min(count, size - pos);
+        string out((const char*)data + pos, count);
+        pos += count;
+        return out;
+    }
+
+    string rest() { return bytes(size - pos); }
+};
+
+typedef vector<vector<string>> PageLines; // Every page has MAX_LINES_PER_PAGE_STORAGE lines
+
+string fuzzFailure = ""; // First property that failed in the current case
+
+bool check(bool condition, const char* property) {
+    if (!condition && fuzzFailure.empty()) fuzzFailure = property;
+    return condition;
+}
+
+// Pages, line counts and line bytes all come from the input, so lines hold
+// delimiters, escape bytes and anything else
+PageLines buildPages(FuzzInput& in) {
+    PageLines pages(1 + in.byte() % 4, vector<string>(MAX_LINES_PER_PAGE_STORAGE));
+    for (size_t p = 0; p < pages.size(); ++p) {
+        int lineCount = in.byte() % (MAX_LINES_PER_PAGE_STORAGE + 1);
+        for (int l = 0; l < lineCount; ++l) pages[p][l] = in.bytes(in.byte() % 48);
+    }
+    return pages;
+}
+
+void installPages(const PageLines& pages) {
+    resetDocumentPages();
+    for (size_t p = 0; p < pages.size(); ++p) {
+        DocumentPage* page = addNewPage();
+        // Indexed halfway as well, so the second indexPage() applies a delta
+        for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) {
+            if (!pages[p][l].empty()) page->setLine(l, pages[p][l]);
+            if (l == MAX_LINES_PER_PAGE_STORAGE / 2) indexPage(page);
+        }
+        indexPage(page);
+    }
+    activeDoc->currentPagePtr = activeDoc->headPage;
+}
+
+PageLines readPages() {
+    PageLines pages;
+    for (int p = 0; p < (int)activeDoc->pageTable.size(); ++p) {
+        pages.push_back(vector<string>(MAX_LINES_PER_PAGE_STORAGE));
+        for (int l = 0; l < MAX_LINES_PER_PAGE_STORAGE; ++l) pages[p][l] = activeDoc->pageTable[p]->getLine(l);
+    }
+    return pages;
+}
+
+// The incrementally kept totals match a recount, and word lookups land on
+// the page that holds the word
+bool statsMatchRecount() {
+    long long words = 0, characters = 0;
+    bool lookupsMatch = true;
+    for (int p = 0; p < (int)activeDoc->pageTable.size(); ++p) {
+        PageStats stats = countSlabStats(activeDoc->pageTable[p]->slab);
+        if (stats.words > 0) {
+            lookupsMatch = lookupsMatch && findPageOfWord(words + 1) == activeDoc->pageTable[p] &&
+                findPageOfWord(words + stats.words) == activeDoc->pageTable[p];
+        }
+        words += stats.words;
+        characters += stats.characters;
+    }
+    return lookupsMatch && words == getWordTotal() && characters == getCharacterTotal() && findPageOfWord(words + 1) == nullptr;
+}
+
+// Any bytes parse, and parsing what was serialized gives the same document
+void propertyParseIsStable(FuzzInput& in) {
+    string raw = in.rest();
+    deserializeDocument(raw);
+    check(statsMatchRecount(), "document statistics match a recount");
+    PageLines parsed = readPages();
+    string serialized = serializeDocument();
+    deserializeDocument(serialized);
+    check(readPages() == parsed, "parse(serialize(parse(x))) == parse(x)");
+    check(serializeDocument() == serialized, "serialize is stable after a re-parse");
+}
+
+// A document with arbitrary line bytes survives serialize/parse unchanged
+void propertyDocumentRoundTrip(FuzzInput& in) {
+    PageLines pages = buildPages(in);
+    installPages(pages);
+    check(statsMatchRecount(), "statistics match a recount after edits");
+    string serialized = serializeDocument();
+    check(startsWith(serialized, document_format_magic), "serialized documents carry the format magic");
+    check(serialized.find(PAGE_DELIMITER) == string::npos || count(serialized.begin(), serialized.end(), PAGE_DELIMITER) == (long)pages.size() - 1,
+        "only page breaks appear as raw page delimiters");
+    deserializeDocument(serialized);
+    check(readPages() == pages, "parse(serialize(doc)) == doc");
+}
+
+// decrypt(encrypt(x)) == x, and ciphering in 8-byte-aligned pieces matches one pass
+void propertyCipherRoundTrip(FuzzInput& in) {
+    string key = in.bytes(in.byte() % 20);
+    string plain = in.rest();
+    string cipher = encrypt(plain, key);
+    check(cipher.length() == plain.length(), "cipher keeps the length");
+    check(decrypt(cipher, key) == plain, "decrypt(encrypt(x, k), k) == x");
+
+    if (plain.length() > 8) {
+        string pieces = plain;
+        int split = (int)((plain.length() / 2) & ~(size_t)7);
+        encryptRange(pieces, key, 0, split);
+        encryptRange(pieces, key, split, (int)pieces.length());
+        check(pieces == cipher, "chunked encrypt matches a single pass");
+    }
+
+    // The wide scans agree with byte-at-a-time versions at any alignment
+    string_view view = string_view(plain).substr(min(plain.length(), key.length() & 15));
+    size_t oddBytes = 0;
+    unsigned char xorSum = 0;
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < view.length(); ++i) {
+        oddBytes += view[i] & 1;
+        xorSum ^= view[i];
+        crc = (crc >> 8) ^ crc32c_tables.values[0][(crc ^ (unsigned char)view[i]) & 0xFF];
+    }
+    check(countLowBits(view.data(), view.length()) == oddBytes, "countLowBits matches a byte loop");
+    check(xorBytes(view.data(), view.length()) == xorSum, "xorBytes matches a byte loop");
+    check(crc32c(view) == ~crc, "crc32c matches a byte loop");
+    size_t split = view.length() / 3;
+    check(crc32c(view.substr(split), crc32c(view.substr(0, split))) == ~crc, "crc32c continues across pieces");
+}
+
+// Encrypted files (either checksum) open with the right key, reject other keys and detect tampering
+void propertyEncryptedFileRoundTrip(FuzzInput& in) {
+    string key = in.bytes(1 + in.byte() % 16);
+    uint8_t tamperAt = in.byte();
+    PageLines pages = buildPages(in);
+    installPages(pages);
+
+    vector<PageSlab*> snapshot = snapshotDocument();
+    string payload = serializeSnapshot(snapshot, nullptr, getKeyFingerprint(key));
+    for (size_t i = 0; i < snapshot.size(); ++i) releaseSlab(snapshot[i]);
+    FileChecksum checksum = (tamperAt & 1) ? CHECKSUM_XOR8 : CHECKSUM_CRC32C;
+    string file = buildEncryptedFile(encrypt(payload, key), checksum);
+
+    string cipher;
+    check(isEncryptedFile(file), "encrypted files are recognised by their magic");
+    check(extractFileCipher(file, cipher), "an intact file passes its checksum");
+    string decrypted = decrypt(cipher, key);
+    check(matchesKeyFingerprint(decrypted, key), "the right key matches the fingerprint");
+    deserializeDocument(string_view(decrypted).substr(key_fingerprint_length));
+    check(readPages() == pages, "open(save(doc, k), k) == doc");
+
+    string otherKey = key + (char)tamperAt;
+    check(!matchesKeyFingerprint(decrypt(cipher, otherKey), otherKey), "a different key is rejected");
+
+    string tampered = file;
+    size_t magicLength = getFileMagic(checksum).length();
+    size_t at = magicLength + tamperAt % (tampered.length() - magicLength);
+    tampered[at] ^= 0x5A;
+    check(!extractFileCipher(tampered, cipher), "a changed byte fails the checksum");
+}
+
+// Hash sequences over a small alphabet, so there are many ways to match
+vector<unsigned long long> buildHashSequence(FuzzInput& in) {
+    vector<unsigned long long> hashes(in.byte() % 24);
+    for (size_t i = 0; i < hashes.size(); ++i) hashes[i] = in.byte() % 4;
+    return hashes;
+}
+
+// Lines the side of a page diff lists, in row order
+vector<int> getDiffSideLines(const PageDiff& diff, bool oldSide) {
+    vector<int> lines;
+    for (size_t r = 0; r < diff.rows.size(); ++r) {
+        int line = oldSide ? diff.rows[r].oldLine : diff.rows[r].newLine;
+        if (line >= 0) lines.push_back(line);
+    }
+    return lines;
+}
+
+// Alignment finds a longest common subsequence; a compare accounts for every
+// page, and each page diff lists every line of its pages once, in order
+void propertyCompareIsConsistent(FuzzInput& in) {
+    vector<unsigned long long> a = buildHashSequence(in), b = buildHashSequence(in);
+    vector<pair<int, int>> matches;
+    bool aligned = alignSequences(a, b, (int)(a.size() + b.size()), matches);
+    bool ordered = aligned;
+    for (size_t i = 0; i < matches.size(); ++i) {
+        ordered = ordered && a[matches[i].first] == b[matches[i].second] &&
+            (i == 0 || (matches[i].first > matches[i - 1].first && matches[i].second > matches[i - 1].second));
+    }
+    vector<vector<int>> common(a.size() + 1, vector<int>(b.size() + 1, 0));
+    for (int i = (int)a.size() - 1; i >= 0; --i) {
+        for (int j = (int)b.size() - 1; j >= 0; --j) {
+            common[i][j] = (a[i] == b[j]) ? common[i + 1][j + 1] + 1 : max(common[i + 1][j], common[i][j + 1]);
+        }
+    }
+    check(ordered, "alignment matches equal items in increasing order");
+    check((int)matches.size() == common[0][0], "alignment is a longest common subsequence");
+
+    // The new version keeps, drops, edits or repeats each old page
+    PageLines oldPages = buildPages(in), newPages;
+    for (size_t p = 0; p < oldPages.size(); ++p) {
+        uint8_t edit = in.byte();
+        if (edit % 4 != 1) newPages.push_back(oldPages[p]);
+        if (edit % 4 == 2) newPages.back()[edit % MAX_LINES_PER_PAGE_STORAGE] = in.bytes(in.byte() % 48);
+        if (edit % 4 == 3) newPages.push_back(oldPages[(p + edit) % oldPages.size()]);
+    }
+    if (newPages.empty()) newPages.push_back(vector<string>(MAX_LINES_PER_PAGE_STORAGE));
+    static Document* oldDocument = new Document(0, "Fuzz old version");
+    {
+        ActiveDocumentScope scope(oldDocument);
+        installPages(oldPages);
+    }
+    installPages(newPages);
+
+    DocumentComparison comparison;
+    compareDocuments(oldDocument, activeDoc, comparison);
+    check(comparison.unchangedPages + comparison.changedPages + comparison.deletedPages == (int)oldPages.size() &&
+        comparison.unchangedPages + comparison.changedPages + comparison.insertedPages == (int)newPages.size(),
+        "a compare accounts for every page");
+    vector<int> lines;
+    vector<unsigned long long> hashes;
+    for (size_t c = 0; c < comparison.changes.size(); ++c) {
+        const PageDiff& diff = comparison.changes[c];
+        collectLineHashes(diff.oldPage < 0 ? nullptr : comparison.oldPages[diff.oldPage], lines, hashes);
+        check(getDiffSideLines(diff, true) == lines, "a page diff lists every old line once");
+        collectLineHashes(diff.newPage < 0 ? nullptr : comparison.newPages[diff.newPage], lines, hashes);
+        check(getDiffSideLines(diff, false) == lines, "a page diff lists every new line once");
+    }
+    releaseComparison(comparison);
+
+    compareDocuments(activeDoc, activeDoc, comparison);
+    check(comparison.changes.empty(), "a document has no changes against itself");
+    releaseComparison(comparison);
+}
+
+// Runs the property chosen by the first byte; returns false on a failure
+bool runFuzzCase(const uint8_t* data, size_t size) {
+    fuzzFailure = "";
+    if (size == 0) return true;
+    FuzzInput in(data + 1, size - 1);
+    switch (data[0] % 5) {
+    case 0: propertyParseIsStable(in); break;
+    case 1: propertyDocumentRoundTrip(in); break;
+    case 2: propertyCipherRoundTrip(in); break;
+    case 3: propertyEncryptedFileRoundTrip(in); break;
+    case 4: propertyCompareIsConsistent(in); break;
+    }
+    return fuzzFailure.empty();
+}
+
+#ifdef DOCEDITOR_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (!runFuzzCase(data, size)) {
+        fprintf(stderr, "Property failed: %s\n", fuzzFailure.c_str());
+        abort();
+    }
+    return 0;
+}
+#else
+/**
+ * Standalone Random Tester
+ * Random inputs are biased towards the bytes the format cares about
+ * (delimiters, the escape byte, '#', spaces) so the interesting paths are
+ * hit often. A failing input is written to a file for replay with --repro.
+ */
+unsigned long long fuzzState = 88172645463325252ULL;
+
+unsigned long long nextFuzzRandom() {
+    fuzzState ^= fuzzState << 13; // xorshift64
+    fuzzState ^= fuzzState >> 7;
+    fuzzState ^= fuzzState << 17;
+    return fuzzState;
+}
+
+void generateFuzzInput(vector<uint8_t>& input, int maxLength) {
+    static const uint8_t special[] = { '\n', '\r', 0x10, '#', ' ', 0x00, 0xFF, 'D', 'O', 'C', '2' };
+    input.resize(1 + nextFuzzRandom() % maxLength);
+    for (size_t i = 0; i < input.size(); ++i) {
+        unsigned long long r = nextFuzzRandom();
+        input[i] = ((r & 3) == 0) ? special[(r >> 8) % sizeof(special)] : (uint8_t)(r >> 16);
+    }
+    // Sometimes start a parse case with the format magic, so escaped parsing is exercised too
+    if (input[0] % 4 == 0 && (nextFuzzRandom() & 1) && input.size() > document_format_magic.length() + 1) {
+        memcpy(&input[1], document_format_magic.data(), document_format_magic.length());
+    }
+}
+
+bool writeBytes(const string& filename, const vector<uint8_t>& bytes) {
+    return writeFile(filename, string(bytes.begin(), bytes.end()));
+}
+
+void printUsage() {
+    fprintf(stderr,
+        "Usage: Fuzz [options]\n"
+        "  --cases N      number of random cases (default 1000000)\n"
+        "  --seconds N    run for N seconds instead of a fixed number of cases\n"
+        "  --seed N       random seed (default 1)\n"
+        "  --max-len N    maximum input length in bytes (default 256)\n"
+        "  --repro FILE   run one saved input and report the result\n");
+}
+
+int main(int argc, char* argv[]) {
+    long long cases = 1000000;
+    int seconds = 0;
+    unsigned long long seed = 1;
+    int maxLength = 256;
+    string repro = "";
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--cases" && hasValue) cases = atoll(argv[++i]);
+        else if (arg == "--seconds" && hasValue) seconds = atoi(argv[++i]);
+        else if (arg == "--seed" && hasValue) seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--max-len" && hasValue) maxLength = atoi(argv[++i]);
+        else if (arg == "--repro" && hasValue) repro = argv[++i];
+        else { printUsage(); return 1; }
+    }
+    if (maxLength < 1 || cases < 1) { printUsage(); return 1; }
+
+    if (!repro.empty()) {
+        string data = readFile(repro);
+        bool passed = runFuzzCase((const uint8_t*)data.data(), data.length());
+        printf("%s%s\n", passed ? "passed" : "FAILED: ", fuzzFailure.c_str());
+        return passed ? 0 : 1;
+    }
+
+    fuzzState ^= seed * 0x9E3779B97F4A7C15ULL;
+    if (fuzzState == 0) fuzzState = 1;
+    vector<uint8_t> input;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long done = 0;
+    while (true) {
+        if (seconds > 0) {
+            if ((done & 1023) == 0 && chrono::steady_clock::now() - start >= chrono::seconds(seconds)) break;
+        }
+        else if (done >= cases) break;
+
+        generateFuzzInput(input, maxLength);
+        if (!runFuzzCase(input.data(), input.size())) {
+            const char* failurePath = "fuzz-failure.bin";
+            writeBytes(failurePath, input);
+            printf("FAILED after %lld cases: %s\nInput saved to %s (replay with --repro)\n", done, fuzzFailure.c_str(), failurePath);
+            return 1;
+        }
+        done++;
+    }
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%lld cases passed in %.1f s (%.0f cases/min)\n", done, elapsed, elapsed > 0 ? done / elapsed * 60 : 0.0);
+    releaseAllPages();
+    destroyPagePool();
+    return 0;
+}
+#endif
@@ -1,57 +1,204 @@
 ﻿#include "pch.h"
+#define DOCEDITOR_ALLOCATION_HOOK // The editor's allocation counter lives in this file (see DocEditor.h)
 #include "DocEditor.h"
 #include <iostream>
 #include <string>
+#ifdef _WIN32
 #include <windows.h>
 #include <conio.h>
+#endif
 #include <vector>
+#include <thread>
+#include <chrono>
+#include <climits>
+#include <cerrno>
 
 using namespace std;
 
+void printUsage() {
+    cout << "Usage: editor [--open FILE]... [--memory-mb N] [--record SCRIPT]\n"
+        << "       editor --replay SCRIPT [--open FILE]... [--report JSON] [--screen FILE]\n"
+        << "       editor --export FILE OUT [--highlight TERM]\n"
+        << "  --open FILE      open a plain-text document (repeat to open several)\n"
+        << "  --memory-mb N    evict inactive documents to disk above N MB (0: never, default 256)\n"
+        << "  --record SCRIPT  save every key typed as a replayable script\n"
+        << "  --replay SCRIPT  run the script headlessly at full speed and report per-key latency\n"
+        << "  --report JSON    write the replay latency report as JSON\n"
+        << "  --screen FILE    write the final in-memory screen after a replay\n"
+        << "  --export FILE OUT  write FILE as text, Markdown or HTML (chosen by OUT's extension)\n"
+        << "  --highlight TERM   mark TERM in the export\n";
+}
+
+// Parses a --memory-mb value: a whole number of megabytes that still fits in bytes
+bool parseMemoryLimit(const char* text, long long& bytes) {
+    char* end = nullptr;
+    errno = 0;
+    long long megabytes = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE) return false;
+    if (megabytes < 0 || megabytes > (LLONG_MAX >> 20)) return false;
+    bytes = megabytes << 20;
+    return true;
+}
+
 // --- Main Interactive Controller ---
-int main() {
+int main(int argc, char* argv[]) {
     // Stage 1: System Initialization
+    vector<string> openPaths;
+    string recordPath = "", replayPath = "", reportPath = "", screenPath = "";
+    string exportInput = "", exportOutput = "", exportHighlight = "";
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--open" && hasValue) openPaths.push_back(argv[++i]);
+        else if (arg == "--memory-mb" && hasValue) {
+            if (!parseMemoryLimit(argv[++i], sessionMemoryLimit)) {
+                cout << "Invalid --memory-mb value: " << argv[i] << " (expected a whole number of MB, 0 or more)\n";
+                return 1;
+            }
+        }
+        else if (arg == "--record" && hasValue) recordPath = argv[++i];
+        else if (arg == "--replay" && hasValue) replayPath = argv[++i];
+        else if (arg == "--report" && hasValue) reportPath = argv[++i];
+        else if (arg == "--screen" && hasValue) screenPath = argv[++i];
+        else if (arg == "--export" && i + 2 < argc) { exportInput = argv[++i]; exportOutput = argv[++i]; }
+        else if (arg == "--highlight" && hasValue) exportHighlight = argv[++i];
+        else { printUsage(); return 1; }
+    }
+
+    // Non-interactive export: streams the file page by page and exits
+    if (!exportInput.empty()) {
+        string error;
+        if (!exportFile(exportInput, exportOutput, exportHighlight, error)) {
+            cout << error << "\n";
+            return 1;
+        }
+        cout << "Exported " << exportInput << " to " << exportOutput << "\n";
+        return 0;
+    }
+
+    // Files for --open are checked before the editor starts; encrypted ones
+    // need their key, which only the O prompt asks for
+    vector<string> openData(openPaths.size());
+    for (int i = 0; i < (int)openPaths.size(); ++i) {
+        openData[i] = readFile(openPaths[i]);
+        if (openData[i].empty()) {
+            cout << "Could not open " << openPaths[i] << " (file not found or empty)\n";
+            return 1;
+        }
+        if (isEncryptedFile(openData[i]) || isLegacyEncryptedFile(openData[i])) {
+            cout << openPaths[i] << " is encrypted; open it with [O] in the editor to enter its key\n";
+            return 1;
+        }
+    }
+
+    if (!replayPath.empty()) {
+        ifstream scriptFile(replayPath.c_str(), ios::binary);
+        string script((istreambuf_iterator<char>(scriptFile)), istreambuf_iterator<char>());
+        if (!scriptFile.is_open() || !decodeKeyScript(script, replayKeys)) {
+            cout << "Could not read key script: " << replayPath << "\n";
+            return 1;
+        }
+        isReplayingInput = true;
+        enableHeadlessScreen();
+    }
+    isRecordingInput = !recordPath.empty() && !isReplayingInput;
+
+    // Each file opens as its own document; the first one starts active
+    Document* firstDocument = activeDoc;
+    for (int i = 0; i < (int)openPaths.size(); ++i) {
+        if (i > 0) createDocument();
+        installLoadedDocument(openData[i], "");
+        activeDoc->name = openPaths[i];
+        string().swap(openData[i]);
+    }
+    switchToDocument(firstDocument);
+
     hideCursor();
 
     // Start with a new, empty document using the Linked List
-    if (headPage == nullptr) {
-        currentPagePtr = addNewPage();
+    if (activeDoc->headPage == nullptr) {
+        activeDoc->currentPagePtr = addNewPage();
     }
-    int currentPage = getPageDisplayNumber(currentPagePtr);
+    int currentPage = getPageDisplayNumber(activeDoc->currentPagePtr);
 
     bool editorRunning = true;
     // Professional Status Bar String
-    string mainStatus = "[A] Add | [S] Search | [E] Encrypt | [V] Save | [O] Open | [I] Index | [U/R] | [N/P] | [L/T/C/J] | [Esc]";
-
-    // Initialize Undo/Redo and Search History
-    clearAllUndoRedoStacks();
-    for (int i = 0; i < search_history_size; ++i) {
-        recentSearches[i] = "";
-        recentCount[i] = 0;
-    }
+    string mainStatus = "[A] Add | [S] Search | [E] Encrypt | [V] Save | [O] Open | [X] Export | [D] Docs | [K] Compare | [I] Index | [G] Go | [M] Stats | [U/R] | [N/P] | [L/T/C/J] | [Esc]";
 
     // Initial Screen Draw
     drawEditorUI(currentPage);
     displayPageContent(currentPage); // Recalculates column balance automatically
     updateMainStatus(mainStatus);
 
+    bool highlightsActive = false; // Search highlights stay up until the next key
+    string shownProgress = "";     // Last progress text drawn, to avoid flicker
+
     // Stage 2: The Main Event Loop
     while (editorRunning) {
-        char input = _getch();
+        // Background Work: poll while tasks run, otherwise block on the keyboard
+        // (a replay waits for the editor to go idle, so every run sees the same states)
+        if (hasBackgroundTasks() && (isReplayingInput || !keyAvailable())) {
+            string message = "";
+            if (pollBackgroundTasks(message)) {
+                currentPage = getPageDisplayNumber(activeDoc->currentPagePtr);
+                drawEditorUI(currentPage);
+                displayPageContent(currentPage);
+                updateMainStatus(mainStatus);
+            }
+            if (!message.empty()) {
+                updateMainStatusTemp(message);
+                shownProgress = message;
+            }
+            else if (hasBackgroundTasks()) {
+                string progress = describeBackgroundProgress();
+                if (progress != shownProgress) {
+                    updateMainStatusTemp(progress);
+                    shownProgress = progress;
+                }
+            }
+            else {
+                updateMainStatus(mainStatus);
+            }
+            if (isReplayingInput) this_thread::sleep_for(chrono::microseconds(100));
+            else this_thread::sleep_for(chrono::milliseconds(15));
+            continue;
+        }
+
+        if (isReplayFinished()) {
+            finishReplayKey();
+            break;
+        }
+        char input = readKey();
+        shownProgress = "";
+
+        // Esc cancels running background work before it can exit the editor
+        if (input == 27 && hasBackgroundTasks()) {
+            cancelBackgroundTasks();
+            updateMainStatusTemp("Cancelling...");
+            continue;
+        }
 
-        bool needsRedraw = false;    // For full UI redraw (borders + text)
-        bool needsRebalance = false; // For just updating the text area
+        // Any key clears the search highlights (and is consumed)
+        if (highlightsActive) {
+            activeDoc->isSearchMode = false;
+            activeDoc->currentSearchTerm = "";
+            highlightsActive = false;
+            displayPageContent(currentPage);
+            clearLine(STATUS_BAR_Y + 1);
+            updateMainStatus(mainStatus);
+            continue;
+        }
 
         bool pageChanged = false;
         bool contentChanged = false;
 
         // Map current page to index for Undo/Redo fixed arrays
-        int pageIndex = (currentPagePtr != nullptr) ? currentPagePtr->pageIndex : -1;
+        int pageIndex = (activeDoc->currentPagePtr != nullptr) ? activeDoc->currentPagePtr->pageIndex : -1;
 
         // Security Guard: Prevent editing while document is scrambled
-        if (isEncrypted && (string("asuri").find(tolower(input)) != string::npos)) {
+        if (activeDoc->isEncrypted && (string("asuri").find(tolower(input)) != string::npos)) {
             updateMainStatusTemp("ACCESS DENIED: Document Encrypted. Press 'E' to Decrypt.");
-            _getch();
+            readKey();
             updateMainStatus(mainStatus);
             continue;
         }
@@ -59,28 +206,28 @@ int main() {
         switch (input) {
             // --- Navigation Logic (Linked List Pointer Jumping) ---
         case 'n': case 'N':
-            if (currentPagePtr != nullptr) {
-                if (currentPagePtr->next != nullptr) {
-                    currentPagePtr = currentPagePtr->next;
+            if (activeDoc->currentPagePtr != nullptr) {
+                if (activeDoc->currentPagePtr->next != nullptr) {
+                    activeDoc->currentPagePtr = activeDoc->currentPagePtr->next;
                 }
                 else {
                     DocumentPage* newPage = addNewPage();
-                    if (newPage != nullptr) currentPagePtr = newPage;
+                    if (newPage != nullptr) activeDoc->currentPagePtr = newPage;
                     else {
                         updateMainStatusTemp("System Error: Page Limit Reached.");
-                        _getch();
+                        readKey();
                         break;
                     }
                 }
-                currentPage = getPageDisplayNumber(currentPagePtr);
+                currentPage = getPageDisplayNumber(activeDoc->currentPagePtr);
                 pageChanged = true;
             }
             break;
 
         case 'p': case 'P':
-            if (currentPagePtr != nullptr && currentPagePtr->prev != nullptr) {
-                currentPagePtr = currentPagePtr->prev;
-                currentPage = getPageDisplayNumber(currentPagePtr);
+            if (activeDoc->currentPagePtr != nullptr && activeDoc->currentPagePtr->prev != nullptr) {
+                activeDoc->currentPagePtr = activeDoc->currentPagePtr->prev;
+                currentPage = getPageDisplayNumber(activeDoc->currentPagePtr);
                 pageChanged = true;
             }
             break;
@@ -94,13 +241,13 @@ int main() {
             break;
 
         case 's': case 'S': {
-            if (currentPagePtr == nullptr) break;
+            if (activeDoc->currentPagePtr == nullptr) break;
 
             string term = getSearchTerm();
             if (!term.empty()) {
                 // Activate Highlighting
-                currentSearchTerm = term;
-                isSearchMode = true;
+                activeDoc->currentSearchTerm = term;
+                activeDoc->isSearchMode = true;
 
                 // Perform search to count matches for history
                 int matches = searchAndHighlight(term); // This can still be used for counting
@@ -112,46 +259,42 @@ int main() {
                 updateMainStatusTemp("Found " + to_string(matches) + " matches. Press any key to clear highlights.");
                 displaySearchHistory();
 
-                _getch(); // Wait for user to see highlights
-
-                // Deactivate Highlighting
-                isSearchMode = false;
-                currentSearchTerm = "";
-
-                // Final Redraw to clear the colors
-                needsRebalance = true;
-                clearLine(STATUS_BAR_Y + 1);
+                // Whole-document totals arrive in the status bar from a worker
+                startDocumentSearchTask(term);
+                highlightsActive = true; // Cleared by the next key press
+            }
+            else {
+                updateMainStatus(mainStatus);
             }
-            updateMainStatus(mainStatus);
             break;
         }
 
         // --- History Management (fixed-array stack access) ---
         case 'u': case 'U': {
-            string state = popUndo(pageIndex);
-            if (!state.empty()) {
+            PageSlab* state = popUndo(pageIndex);
+            if (state != nullptr) {
                 pushRedo(pageIndex);
-                deserializePage(currentPagePtr, state);
+                restorePageSnapshot(activeDoc->currentPagePtr, state);
                 contentChanged = true;
             }
             else {
                 updateMainStatusTemp("Undo Stack Empty.");
-                _getch();
+                readKey();
             }
             updateMainStatus(mainStatus);
             break;
         }
 
         case 'r': case 'R': {
-            string state = popRedo(pageIndex);
-            if (!state.empty()) {
+            PageSlab* state = popRedo(pageIndex);
+            if (state != nullptr) {
                 pushUndoForRedo(pageIndex);
-                deserializePage(currentPagePtr, state);
+                restorePageSnapshot(activeDoc->currentPagePtr, state);
                 contentChanged = true;
             }
             else {
                 updateMainStatusTemp("Redo Stack Empty.");
-                _getch();
+                readKey();
             }
             updateMainStatus(mainStatus);
             break;
@@ -159,36 +302,33 @@ int main() {
 
         // --- Security (Bitwise Shuffle & Block Cipher) ---
         case 'e': case 'E': {
-            if (!isEncrypted) {
+            if (isTaskKindRunning(TASK_CIPHER) || isTaskKindRunning(TASK_LOAD)) {
+                updateMainStatusTemp("Please wait for the current open/encrypt to finish.");
+                break;
+            }
+            if (!activeDoc->isEncrypted) {
                 updateMainStatusTemp("Enter Encryption Key to Scramble: ");
-                encryptionKey = getSimpleTextInput(32);
-                if (encryptionKey.empty()) {
+                string key = getSimpleTextInput(32);
+                if (key.empty()) {
                     updateMainStatus(mainStatus);
                     break;
                 }
 
-                // Scramble the entire linked list
-                string docData = serializeDocument();
-                string encryptedData = encrypt(docData, encryptionKey);
-                deserializeDocument(encryptedData); // Rebuilds list with scrambled text
-
-                isEncrypted = true;
-                updateMainStatusTemp("Document Scrambled! Press any key.");
+                // Scramble the entire linked list on a worker (plain pages kept as snapshots);
+                // the document takes the key once the scrambled view is installed
+                startScrambleTask(key);
             }
             else {
                 updateMainStatusTemp("Enter Key to Decrypt: ");
                 string keyAttempt = getSimpleTextInput(22);
 
-                // Despise the noise back into readable text
-                string docData = serializeDocument();
-                string decryptedData = decrypt(docData, keyAttempt);
-                deserializeDocument(decryptedData); // Rebuilds list with clean text
-
-                isEncrypted = false;
-                updateMainStatusTemp("Document Restored! Press any key.");
+                // Despise the noise back into readable text (instant with the right key)
+                if (startUnscrambleTask(keyAttempt)) {
+                    updateMainStatusTemp("Document Restored! Press any key.");
+                    readKey();
+                    pageChanged = true; // Force UI redraw
+                }
             }
-            _getch();
-            pageChanged = true; // Force UI redraw
             break;
         }
 
@@ -198,9 +338,44 @@ int main() {
         case 'c': case 'C': currentAlignment = 2; contentChanged = true; break;
         case 'j': case 'J': currentAlignment = 3; contentChanged = true; break;
 
-        case 'i': case 'I': handleTOCView(currentPage, mainStatus); break;
-        case 'v': case 'V': saveDocumentToFile(); updateMainStatus(mainStatus); break;
-        case 'o': case 'O': if (loadDocumentFromFile(mainStatus)) pageChanged = true; break;
+        // --- Direct Jumps (constant-time via the page index) ---
+        case 'i': case 'I':
+            if (handleTOCView(currentPage, mainStatus)) {
+                currentPage = getPageDisplayNumber(activeDoc->currentPagePtr);
+                pageChanged = true;
+            }
+            break;
+
+        case 'g': case 'G':
+            if (handleGotoPage(mainStatus)) {
+                currentPage = getPageDisplayNumber(activeDoc->currentPagePtr);
+                pageChanged = true;
+            }
+            break;
+
+        // --- Open Documents (switch, new, close) ---
+        case 'd': case 'D':
+            if (handleDocumentListView(currentPage, mainStatus)) {
+                currentPage = getPageDisplayNumber(activeDoc->currentPagePtr);
+                pageChanged = true;
+            }
+            break;
+
+        // --- Compare with another open document ---
+        case 'k': case 'K':
+            if (handleCompareView(currentPage, mainStatus)) {
+                currentPage = getPageDisplayNumber(activeDoc->currentPagePtr);
+                pageChanged = true;
+            }
+            break;
+
+        // --- Diagnostics ---
+        case 'm': case 'M': handlePerfStatsView(currentPage, mainStatus); break;
+
+        // --- Persistence (runs in the background, see pollBackgroundTasks) ---
+        case 'v': case 'V': saveDocumentToFile(); if (!hasBackgroundTasks()) updateMainStatus(mainStatus); break;
+        case 'o': case 'O': loadDocumentFromFile(mainStatus); break;
+        case 'x': case 'X': exportDocumentToFile(mainStatus); if (!hasBackgroundTasks()) updateMainStatus(mainStatus); break;
 
         case 27: // ESC key
             editorRunning = false;
@@ -218,14 +393,18 @@ int main() {
             displayPageContent(currentPage);
         }
     }
+    finishReplayKey(); // Records the key that ended the loop (Esc)
 
     // Stage 3: Graceful Shutdown (Memory Management)
-    DocumentPage* current = headPage;
-    while (current != nullptr) {
-        DocumentPage* next = current->next;
-        delete current;
-        current = next;
+    finishBackgroundTasks();
+    if (isReplayingInput) {
+        disableHeadlessScreen();
+        if (!screenPath.empty()) writeFile(screenPath, headlessScreen.dump());
+        printReplayReport(reportPath);
     }
+    if (isRecordingInput) writeFile(recordPath, encodeKeyScript(recordedKeys));
+    closeAllDocuments();
+    destroyPagePool();
 
     return 0;
 }
\ No newline at end of file
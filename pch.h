@@ -0,0 +1,10 @@
+﻿#pragma once
+// Precompiled header: the standard and platform headers DocEditor.h uses
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <conio.h>
+#endif